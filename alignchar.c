@@ -28,12 +28,92 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Where POSIX is available, it is used to walk directories and run worker
+//  threads. Elsewhere only the C99 standard library is needed.
+#if defined(__unix__) || defined(__APPLE__)
+#define ALIGNCHAR_POSIX 1
+#define _POSIX_C_SOURCE 200809L
+#else
+#define ALIGNCHAR_POSIX 0
+#endif
+
+// On Linux, hardware performance counters are read with perf_event_open.
+#if defined(__linux__)
+#define ALIGNCHAR_PERF 1
+// For syscall().
+#define _DEFAULT_SOURCE
+#else
+#define ALIGNCHAR_PERF 0
+#endif
+
 #include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if ALIGNCHAR_POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Static tracepoints (USDT) for bpftrace, perf, and SystemTap are compiled in
+//  where <sys/sdt.h> is available, unless built with -DALIGNCHAR_NO_SDT.
+// An unattached tracepoint is a single nop.
+#if !defined(ALIGNCHAR_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ALIGNCHAR_SDT 1
+#endif
+#endif
+
+#ifndef ALIGNCHAR_SDT
+#define ALIGNCHAR_SDT 0
+#endif
+
+#if ALIGNCHAR_SDT
+#define TRACEPOINT1(name, a) STAP_PROBE1(alignchar, name, a)
+#define TRACEPOINT2(name, a, b) STAP_PROBE2(alignchar, name, a, b)
+#define TRACEPOINT3(name, a, b, c) STAP_PROBE3(alignchar, name, a, b, c)
+#else
+#define TRACEPOINT1(name, a) ((void)0)
+#define TRACEPOINT2(name, a, b) ((void)0)
+#define TRACEPOINT3(name, a, b, c) ((void)0)
+#endif
+
+// Relaxed atomic load and store, for counters read by another thread.
+// Such counters are declared volatile, so elsewhere plain accesses to them
+//  are not cached or elided.
+#if defined(__GNUC__)
+#define RELAXED_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+#define RELAXED_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#else
+#define RELAXED_STORE(ptr, val) (*(ptr) = (val))
+#define RELAXED_LOAD(ptr) (*(ptr))
+#endif
+
+// Publish how far the line engine is into its input, for --progress.
+// Only readers given a progress counter publish to it, so worker threads
+//  and runs without --progress do not write shared memory per line.
+#define PROGRESS_NOTE(reader) \
+	do { \
+		if ((reader)->progress != NULL) { \
+			RELAXED_STORE((reader)->progress, \
+				(reader)->mem_pos + (reader)->file_read); \
+		} \
+	} while (0)
+
+#if ALIGNCHAR_PERF
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -48,12 +128,107 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define VERSION_STR "0.2.0"
 
-// When output mode is to modify the input file in place,
-//  rename the input file to this name and read from it.
-// If program outputs changed file to original input file path successfully,
-//  then delete this file.
-// If there is an error outputting, this file gets left behind (good).
-#define INPUT_PATH_RENAMED "~alignchar_input_file_backup!!!"
+// Rule values used when not given on the command line.
+#define DEFAULT_TARGET_CHAR '\\'
+// First column is 1.
+#define DEFAULT_TARGET_POS 80
+#define DEFAULT_FILL_CHAR ' '
+
+// Capacity of memory used to hold the input when it must be seen twice
+//  (see --position auto). Input beyond this spills to a temporary file.
+#define SPOOL_CAP (4 * 1024 * 1024) // 4 MiB. Keep --help in sync.
+
+// Capacity of memory used to hold one run of consecutive matching lines
+//  (see --position block). Also the largest allowed --block-cap.
+#define BLOCK_CAP 65536
+
+// Maximum number of fields per line aligned by --columns.
+// Occurrences of the --columns char past this many are left unchanged.
+#define MAX_COLUMNS 256
+
+// Capacity of an anchor token including null-terminator.
+#define ANCHOR_CAP 16 // Keep --help in sync.
+
+// Widths counted separately by --census. Wider lines are counted as this
+//  width minus one. Positions are always narrower than BUF_CAP.
+#define CENSUS_WIDTHS (BUF_CAP + 1)
+
+// Capacity of a path (including null-terminator) taken from a directory walk.
+#define PATH_CAP 4096
+
+// Number of paths that can wait for a worker thread.
+#define PATH_QUEUE_CAP 64
+
+// Maximum number of worker threads (-j).
+#define MAX_JOBS 64
+
+// Number of events each thread keeps for --trace.
+#define TRACE_RING_CAP 1024
+
+// Capacity of the path (including null-terminator) kept per --trace event.
+// Longer paths keep their last TRACE_PATH_CAP - 1 chars.
+#define TRACE_PATH_CAP 64
+
+// Milliseconds between --progress updates.
+#define PROGRESS_INTERVAL_MS 500
+
+// Capacity of memory each --files-from worker holds input in for -p auto and
+//  --columns before spilling to a temporary file. Smaller than SPOOL_CAP
+//  as there is one per worker.
+#define WORKER_SPOOL_CAP (256 * 1024)
+
+// Appended to a path for the temporary file that --in-place writes before
+//  renaming it over the path.
+#define ALIGNED_PATH_SUFFIX ".alignchar~"
+
+// Files over this many bytes are split into chunks by --files-from
+//  (see --split-size). Keep --help in sync.
+#define DEFAULT_SPLIT_SIZE (64 * 1024 * 1024)
+
+// Most chunks a file is split into. Larger files get larger chunks.
+#define MAX_SPLIT_CHUNKS 256
+
+// Number of listed paths --files-from picks the largest file from.
+#define SCHEDULE_WINDOW 256
+
+// Most bytes --files-from advises to be read ahead for queued files with
+//  --prefetch. Keep --help in sync.
+#define DEFAULT_PREFETCH_BYTES (64 * 1024 * 1024)
+
+// Input files smaller than this many bytes are read with a single read
+//  (see read_small_file) and aligned from memory.
+#define SMALL_FILE_CAP (64 * 1024)
+
+// Capacity of the output buffer for small files. The aligned form of a small
+//  file that fits is written with a single write.
+#define SMALL_OUT_CAP (4 * SMALL_FILE_CAP)
+
+// Files that can be split at once. Each one has a chunk waiting in the
+//  queue or being aligned by a worker, so this many is always enough.
+#define SPLIT_CAP (PATH_QUEUE_CAP + MAX_JOBS + 1)
+
+// Largest --read-chunk, and the size used without it or a tuning file.
+#define READ_CHUNK_CAP (256 * 1024) // 262144. Keep --help in sync.
+#define DEFAULT_READ_CHUNK 65536
+
+// Largest --io-buffer, and the size used without it or a tuning file.
+// 0 leaves output buffering to stdio.
+#define IO_BUF_CAP (1024 * 1024) // 1048576. Keep --help in sync.
+#define DEFAULT_IO_BUF 0
+
+// Environment variable naming the tuning file written by --calibrate.
+// Without it, the tuning file is TUNING_FILE_NAME in $HOME.
+#define TUNING_ENV "ALIGNCHAR_TUNING"
+#define TUNING_FILE_NAME ".alignchar_tuning"
+
+// Bytes of generated text --calibrate times each setting over.
+#define CALIBRATE_TEXT_CAP (4 * 1024 * 1024)
+
+// Maximum number of alignment rules given in one invocation.
+#define MAX_RULES 16
+
+// Value in align_config.rule_index for chars that no rule targets.
+#define NO_RULE UINT8_MAX
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -70,42 +245,410 @@ enum output_mode {
 	OUTPUT_MODE_IN_PLACE = 2 // Modify input file
 };
 
+// How the target column of a rule is chosen
+enum position_mode {
+	POSITION_MODE_FIXED = 0, // target_pos as given
+	POSITION_MODE_AUTO = 1,  // Widest candidate line in the file + pos_offset
+	POSITION_MODE_BLOCK = 2  // Widest line of each run of candidate lines
+	                         //  + pos_offset
+};
+
+// Source of input bytes.
+// mem is read first, then file (if not NULL).
+// file is read chunk_cap chars at a time into chunk.
+struct reader {
+	const char *mem;
+	size_t mem_len;
+	size_t mem_pos;
+
+	FILE *file;
+	// Number of chars consumed from file so far.
+	size_t file_read;
+	// Number of chars of file left to read, or SIZE_MAX to read to its end.
+	size_t file_left;
+
+	char *chunk;
+	size_t chunk_cap;
+	// chunk[chunk_pos..chunk_len) has been read from file but not consumed.
+	size_t chunk_len;
+	size_t chunk_pos;
+
+	// Where to publish the chars consumed for --progress, or NULL.
+	volatile size_t *progress;
+};
+
+// Bytes held for a second pass over the input without reading it again.
+// Held in mem until full, then in a temporary spill file.
+struct spool {
+	char *mem;
+	size_t mem_cap;
+	size_t mem_len;
+
+	// NULL until mem is full.
+	FILE *spill;
+};
+
+// Where in a line the text to align (the anchor) is found
+enum anchor_mode {
+	ANCHOR_MODE_END = 0,   // target_char just before the '\n'
+	ANCHOR_MODE_FIRST = 1, // First occurrence of anchor
+	ANCHOR_MODE_LAST = 2   // Last occurrence of anchor
+};
+
+// What to align, where to align it, and what to pad with.
+struct align_rule {
+	enum anchor_mode anchor_mode;
+	// For ANCHOR_MODE_END.
+	char target_char;
+	// For ANCHOR_MODE_FIRST and ANCHOR_MODE_LAST. Null-terminated.
+	char anchor[ANCHOR_CAP];
+	size_t anchor_len;
+
+	// First column is 1.
+	// For POSITION_MODE_AUTO, set once the input has been measured.
+	size_t target_pos;
+	char fill_char;
+
+	enum position_mode pos_mode;
+	// Columns added to the measured width when pos_mode is not FIXED.
+	size_t pos_offset;
+
+	// Whether each of the above was given on the command line.
+	// Giving a field that is already set starts a new rule.
+	bool has_char;
+	bool has_pos;
+	bool has_fill;
+};
+
+// Everything the line engine needs to know.
+struct align_config {
+	struct align_rule rules[MAX_RULES];
+	size_t num_rules;
+
+	// Index into rules of the ANCHOR_MODE_END rule targeting each char,
+	//  or NO_RULE.
+	// Indexed by the char before a line's '\n' cast to unsigned char.
+	uint8_t rule_index[256];
+
+	// Indices into rules of the other rules, tried in order on lines that
+	//  no ANCHOR_MODE_END rule matched.
+	uint8_t mid_rules[MAX_RULES];
+	size_t num_mid_rules;
+
+	// The tab width value to use when calculating line width.
+	size_t tab_width;
+
+	// Whether to strip existing padding before the target char (--realign).
+	bool realign;
+	// Whether to pad with tabs before fill chars (--fill-tabs).
+	bool fill_tabs;
+	// Whether end-of-line rules only apply to preprocessor directive
+	//  continuations (--cpp-only).
+	bool cpp_only;
+
+	// Whether to align every occurrence of columns_char into columns
+	//  (--columns) instead of applying the rules.
+	bool columns;
+	char columns_char;
+
+	// Most bytes of a run of lines held for POSITION_MODE_BLOCK.
+	// Longer runs are aligned to DEFAULT_TARGET_POS instead.
+	size_t block_cap;
+
+	// Chars read from the input at once (--read-chunk).
+	size_t read_chunk;
+	// Size of the output buffer, or 0 for stdio's default (--io-buffer).
+	size_t io_buf;
+};
+
+// Which rule applies to a line and where in the line its anchor starts.
+struct line_match {
+	// NO_RULE if no rule applies.
+	uint8_t rule_i;
+	size_t anchor_at;
+};
+
+// What the --cpp-only lexer is inside of
+enum cpp_state {
+	CPP_STATE_CODE = 0,
+	CPP_STATE_STRING = 1,
+	CPP_STATE_CHAR = 2,
+	CPP_STATE_BLOCK_COMMENT = 3,
+	CPP_STATE_LINE_COMMENT = 4
+};
+
+// State of the lexer behind --cpp-only, carried from line to line.
+// Zero-initialize to start at the beginning of a file.
+struct cpp_lexer {
+	enum cpp_state state;
+	// Whether the current logical line (physical lines joined by
+	//  backslash-newline) is a preprocessor directive.
+	bool in_directive;
+	// Whether only whitespace has been seen on the current logical line.
+	bool at_line_start;
+	// Whether the previous byte was a backslash inside a literal.
+	bool escaped;
+	// The previous byte, for "/*", "*/", "//", and backslash-newline.
+	char prev;
+};
+
+// Consecutive lines matched by a POSITION_MODE_BLOCK rule, held until the
+//  run ends so they can be aligned to the widest of them.
+struct block {
+	char *mem;
+	size_t len;
+
+	// Rule that matched the held lines, or NO_RULE if none are held.
+	uint8_t rule_i;
+	// Width of the widest held line.
+	size_t max_width;
+	// Set once the run outgrows block_cap. Lines of the run are then
+	//  aligned to DEFAULT_TARGET_POS as they arrive.
+	bool overflowed;
+};
+
+// Widths of matching lines across the files scanned by --census.
+struct census {
+	// Number of matching lines of each width.
+	size_t line_widths[CENSUS_WIDTHS];
+	// Number of files whose narrowest matching line has each width.
+	size_t file_widths[CENSUS_WIDTHS];
+
+	size_t num_files;
+	size_t num_lines;
+};
+
+#if ALIGNCHAR_POSIX
+// A file over --split-size being aligned in chunks by --files-from workers.
+// Each chunk is aligned into its own temporary file. The worker finishing
+//  the last chunk joins them, in order, over the file.
+// Fields other than path are guarded by the split_table mutex.
+struct split_file {
+	char path[PATH_CAP];
+	size_t num_chunks;
+	size_t num_done;
+	// Set if any chunk failed, leaving the file unchanged.
+	bool failed;
+	bool in_use;
+};
+
+// A listed path waiting to be queued by --files-from, and its file's size.
+struct pending_file {
+	char path[PATH_CAP];
+	size_t size;
+};
+
+// A file, or a chunk of one, waiting for a worker thread.
+struct work_item {
+	char path[PATH_CAP];
+	// The chunk of split starting offset chars into the file that is len
+	//  chars long (SIZE_MAX to the end), or NULL for the whole file.
+	struct split_file *split;
+	size_t chunk_i;
+	size_t offset;
+	size_t len;
+	// Size of the whole file when it was listed, or SIZE_MAX if not known.
+	size_t size;
+	// Bytes of it advised to be read ahead (--prefetch), counted in the
+	//  queue's prefetched until the item is taken.
+	size_t prefetched;
+};
+
+// Files (or chunks of them) waiting for a worker thread.
+// Fixed-size so nothing is allocated.
+struct path_queue {
+	struct work_item items[PATH_QUEUE_CAP];
+	// Index of the next item to take.
+	size_t head;
+	size_t count;
+	// Set once no more paths will be added.
+	bool closed;
+
+	// Items ever added and taken, so the prefetcher can keep its place.
+	size_t num_pushed;
+	size_t num_popped;
+	// Sum of prefetched over the waiting items.
+	size_t prefetched;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	// Signaled when an item is added or taken, or the queue is closed.
+	pthread_cond_t changed;
+};
+#endif
+
+// Counts accumulated by the line engine.
+struct align_stats {
+	// Per rule, number of lines that ended in the rule's target char.
+	size_t num_matched[MAX_RULES];
+	// Per rule, number of those lines that were changed.
+	size_t num_aligned[MAX_RULES];
+
+	// Lines read, including those too long to align.
+	size_t num_lines;
+	// Lines passed through unchanged for being BUF_CAP chars or longer.
+	size_t num_long_lines;
+	// Matched lines whose anchor was already on or past the column.
+	size_t num_past;
+	// Chars written as padding.
+	size_t pad_written;
+	// Chars of existing padding removed (--realign).
+	size_t pad_removed;
+};
+
+// Parts of a run timed by --stats
+enum phase {
+	PHASE_OPEN = 0,    // Opening files
+	PHASE_MEASURE = 1, // Reading the input into the spool while measuring
+	PHASE_ALIGN = 2,   // Aligning and writing the output
+	PHASE_CLOSE = 3,   // Closing (and for --in-place, renaming) files
+	NUM_PHASES = 4
+};
+
+// Hardware events counted by --perf-counters
+enum perf_counter {
+	PERF_COUNTER_CYCLES = 0,
+	PERF_COUNTER_INSTRUCTIONS = 1,
+	PERF_COUNTER_BRANCH_MISSES = 2,
+	PERF_COUNTER_CACHE_MISSES = 3,
+	NUM_PERF_COUNTERS = 4
+};
+
+// Seconds spent in each phase.
+struct phase_times {
+	double wall[NUM_PHASES];
+	double cpu[NUM_PHASES];
+
+	// Hardware events counted in each phase (--perf-counters).
+	uint64_t events[NUM_PHASES][NUM_PERF_COUNTERS];
+
+	// Clocks when the current phase started.
+	double begun_wall;
+	double begun_cpu;
+
+	// File and thread that phases are attributed to in --trace output.
+	const char *path;
+	size_t trace_thread;
+
+	// Whether each phase started is published for --progress.
+	bool show_progress;
+};
+
+// A span of time recorded for --trace.
+struct trace_event {
+	// A string literal.
+	const char *name;
+	// The end of the path of the file being worked on. Null-terminated.
+	char path[TRACE_PATH_CAP];
+	// Seconds since trace_epoch.
+	double start;
+	double end;
+};
+
+// Events recorded by one thread for --trace.
+// When full, the oldest events are overwritten.
+struct trace_ring {
+	struct trace_event events[TRACE_RING_CAP];
+	// Number of events ever recorded. May exceed TRACE_RING_CAP.
+	size_t count;
+};
+
+// Chars of its input the line engine has consumed in the current phase,
+//  and the current phase, for --progress.
+// Stored with relaxed atomics and read by the progress thread.
+static volatile size_t progress_done = 0;
+static volatile int progress_phase = PHASE_OPEN;
+
 ////////////////////////////////////////////////////////////////////////////////
 
-// Get char from fp and populate out with that char.
-// If error, print to stderr and exit.
-// Return true if out populated else return false (end-of-file was reached).
-// out is unchanged if false returned.
-bool try_fgetc(FILE *const fp, char *const out) {
-	const int ch = fgetc(fp);
+// Point span at the chars of reader not yet consumed and return how many
+//  there are, reading the next chunk of file if none are left.
+// Return 0 if the end of input was reached.
+// If file error, print to stderr and exit.
+size_t reader_peek(struct reader *const reader, const char **const span) {
+	if (reader->mem_pos < reader->mem_len) {
+		*span = reader->mem + reader->mem_pos;
+		return reader->mem_len - reader->mem_pos;
+	}
 
-	if (ch == EOF) {
-		int ferr = ferror(fp);
+	if (reader->file == NULL) {
+		return 0;
+	}
 
-		if (ferr != 0) {
-			perror("fgetc error");
-			exit(1);
+	if (reader->chunk_pos == reader->chunk_len) {
+		const size_t want = (reader->chunk_cap < reader->file_left) ?
+			reader->chunk_cap : reader->file_left;
+
+		reader->chunk_pos = 0;
+		reader->chunk_len = (want > 0) ?
+			fread(reader->chunk, 1, want, reader->file) : 0;
+
+		if (reader->file_left != SIZE_MAX) {
+			reader->file_left -= reader->chunk_len;
+		}
+
+		// Args: bytes read.
+		TRACEPOINT1(block_read, reader->chunk_len);
+
+		if (reader->chunk_len == 0) {
+			if (ferror(reader->file) != 0) {
+				perror("fread error");
+				exit(1);
+			}
+
+			// Reached end-of-file, or read all of file_left.
+			return 0;
 		}
+	}
+
+	*span = reader->chunk + reader->chunk_pos;
+	return reader->chunk_len - reader->chunk_pos;
+}
+
+// Consume count of the chars last returned by reader_peek.
+void reader_skip(struct reader *const reader, const size_t count) {
+	if (reader->mem_pos < reader->mem_len) {
+		reader->mem_pos += count;
+	}
+	else {
+		reader->chunk_pos += count;
+		reader->file_read += count;
+	}
+}
+
+// Get the next char from reader and populate out with that char.
+// If file error, print to stderr and exit.
+// Return true if out populated else return false (end of input was reached).
+// out is unchanged if false returned.
+bool reader_getc(struct reader *const reader, char *const out) {
+	const char *span;
 
-		// Reached end-of-file.
+	if (reader_peek(reader, &span) == 0) {
 		return false;
 	}
 
-	*out = (char)ch;
+	*out = span[0];
+	reader_skip(reader, 1);
 	return true;
 }
 
-// fputc but calls perror and non-zero exits if error.
-void checked_fputc(const char ch, FILE *const stream) {
-	const int code = fputc(ch, stream);
+// Write buf_len number of chars from buf into file.
+// Print to stderr and non-zero exit if error.
+void ensure_fwriten(FILE *const file, const char *const buf,
+	const size_t buf_len)
+{
+	const size_t num_written = fwrite(buf, sizeof(char), buf_len, file);
+
+	if (num_written != buf_len) {
+		fprintf(stderr, "%s: Expected: %ld Actual %ld\n", __func__, buf_len,
+			num_written);
 
-	if (code != ch) {
-		perror("fputc error");
 		exit(1);
 	}
 }
 
-// Read from file into buf of capacity buf_cap until target is found.
+// Read from reader into buf of capacity buf_cap until target is found.
 // num_written is set to the number of characters written into buf (not
 //  including the null-terminator).
 // If target is found, it does get written into buf.
@@ -118,7 +661,7 @@ void checked_fputc(const char ch, FILE *const stream) {
 #define RTC_SUCCESS 0
 #define RTC_EOF_REACHED 1
 #define RTC_BUF_FULL 2
-uint8_t read_through_char(FILE *const file, char *const buf,
+uint8_t read_through_char(struct reader *const reader, char *const buf,
 	const size_t buf_cap, const char target, size_t *const num_written)
 {
 	*num_written = 0;
@@ -133,48 +676,57 @@ uint8_t read_through_char(FILE *const file, char *const buf,
 	}
 
 	while (true) {
-		char ch;
-		if (try_fgetc(file, &ch)) {
-			buf[*num_written] = ch;
-			*num_written += 1;
+		const char *span;
+		const size_t span_len = reader_peek(reader, &span);
 
-			if (target == ch) {
-				buf[*num_written] = '\0';
-				return RTC_SUCCESS;
-			}
-			else if ((buf_cap - 1) == *num_written) {
-				buf[*num_written] = '\0';
-				return RTC_BUF_FULL;
-			}
-			else if (*num_written >= buf_cap) {
-				// Either no room for '\0' or overflowed past end.
-				fprintf(stderr, "%s: Impossible buf overflow.\n", __func__);
-				exit(1);
-			}
-		}
-		else {
+		if (span_len == 0) {
 			// EOF was reached.
 			// The target char was never found.
 			buf[*num_written] = '\0';
 			return RTC_EOF_REACHED;
 		}
-	}
 
-	fprintf(stderr, "%s: Unreachable.\n", __func__);
-	exit(1);
+		// Copy through the target, or as much as fits leaving room for '\0'.
+		const size_t room = buf_cap - 1 - *num_written;
+		const size_t len = (span_len < room) ? span_len : room;
+		const char *const found = memchr(span, target, len);
+		const size_t copy_len = (found != NULL) ?
+			(size_t)(found - span) + 1 : len;
+
+		memcpy(buf + *num_written, span, copy_len);
+		*num_written += copy_len;
+		reader_skip(reader, copy_len);
+
+		if (found != NULL) {
+			buf[*num_written] = '\0';
+			return RTC_SUCCESS;
+		}
+		else if ((buf_cap - 1) == *num_written) {
+			buf[*num_written] = '\0';
+			return RTC_BUF_FULL;
+		}
+	}
 }
 
 // Copy from in into out until target found. Target gets copied.
 // Return true if target found.
 // Return false if EOF reached before target found.
 // Prints to stderr and non-zero exits if file error.
-bool transfer_through_char(FILE *const in, FILE *const out, const char target)
+bool transfer_through_char(struct reader *const in, FILE *const out,
+	const char target)
 {
-	char ch;
-	while (try_fgetc(in, &ch)) {
-		checked_fputc(ch, out);
+	const char *span;
+	size_t span_len;
+
+	while ((span_len = reader_peek(in, &span)) > 0) {
+		const char *const found = memchr(span, target, span_len);
+		const size_t copy_len = (found != NULL) ?
+			(size_t)(found - span) + 1 : span_len;
 
-		if (target == ch) {
+		ensure_fwriten(out, span, copy_len);
+		reader_skip(in, copy_len);
+
+		if (found != NULL) {
 			return true;
 		}
 	}
@@ -182,141 +734,3223 @@ bool transfer_through_char(FILE *const in, FILE *const out, const char target)
 	return false;
 }
 
-// Return the width of line if tabs are tab_width wide.
-// Returns wrong answer if line is wider than SIZE_MAX columns.
-size_t get_line_width(const char *line, const size_t tab_width) {
+// Return the width of the first len chars of span if tabs are tab_width wide.
+// Returns wrong answer if span is wider than SIZE_MAX columns.
+size_t get_span_width(const char *const span, const size_t len,
+	const size_t tab_width)
+{
 	size_t width = 0;
 
-	while ('\0' != line[0] && '\n' != line[0]) {
-		if ('\t' == line[0]) {
+	for (size_t i = 0; i < len; i += 1) {
+		if ('\t' == span[i]) {
 			width += tab_width;
 		}
 		else {
 			width += 1;
 		}
-
-		// Move pointer to next char.
-		line += 1;
 	}
 
 	return width;
 }
 
-// Write buf_len number of chars from buf into file.
+// Append len chars from buf to spool.
+// Once spool's memory is full, the rest goes to a temporary spill file.
 // Print to stderr and non-zero exit if error.
-void ensure_fwriten(FILE *const file, const char *const buf,
-	const size_t buf_len)
+void spool_write(struct spool *const spool, const char *const buf,
+	const size_t len)
 {
-	const size_t num_written = fwrite(buf, sizeof(char), buf_len, file);
+	const size_t room = spool->mem_cap - spool->mem_len;
+	const size_t to_mem = (len < room) ? len : room;
 
-	if (num_written != buf_len) {
-		fprintf(stderr, "%s: Expected: %ld Actual %ld\n", __func__, buf_len,
-			num_written);
+	memcpy(spool->mem + spool->mem_len, buf, to_mem);
+	spool->mem_len += to_mem;
 
-		exit(1);
+	if (to_mem == len) {
+		return;
 	}
-}
 
-// Print help to stdout.
-// Return 0 if successful.
-// Return 1 if error printing.
-int print_help(void) {
-	const int code = fputs(
-"alignchar: For the given input file, for each line that ends in the target\n"
-"           character (Default: '\\'), align the target character to the\n"
-"           target column position (Default: 80. First column is 1) using the\n"
-"           fill character (Default: ' '). Non-matching lines, lines of\n"
-"           length " XSTR(BUF_CAP)
-                        " and greater, and lines where the target character\n"
-"           falls on or after the target column position are unchanged.\n"
-"\n"
-"Usage examples:\n"
-"  alignchar [options] -i <input file> -o <output file>\n"
-"  alignchar [options] -i <input file> --in-place\n"
-"\n"
-"An input file must be specified (-i or --input).\n"
-"Either an output file must be specified (-o or --output)\n"
-"    or --in-place must be specified meaning modify the input file."
-"\n"
-"Options may be given in any order.\n"
-"\n"
-"Options:\n"
-"  --help               Stop parsing options, print help, exit(0)\n"
-"  --version            Stop parsing options, print version, exit(0)\n"
-"\n"
-"  -i, --input <path>   Specify input file (required)\n"
-"  -o, --output <path>  Specify output file\n"
-"                       (mutually exclusive with --in-place)\n"
-"                       Do NOT specify the same path as for input\n"
-"                       (use --in-place instead)\n"
-"  --in-place           Modify input file\n"
-"                       (mutually exclusive with -o, --output)\n"
-"  -c, --char <char>    Specify the character to be aligned (Default: '\\')\n"
-"  -p, --position <n>   Specify the column to align the character to\n"
-"                       (Default: 80)\n"
-"  -f, --fill <char>    Specify the fill character (Default: ' ')\n"
-"  -t, --tab-width <n>  Specify tab width (Default: 4)\n"
-"\n"
-	, stdout);
+	if (spool->spill == NULL) {
+		spool->spill = tmpfile();
 
-	if (code != EOF) {
-		// Printed successfully.
-		return 0;
+		if (spool->spill == NULL) {
+			perror("Error: Failed to create spill file");
+			exit(1);
+		}
 	}
 
-	// There was an error printing.
-	return 1;
+	ensure_fwriten(spool->spill, buf + to_mem, len - to_mem);
 }
 
-////////////////////////////////////////////////////////////////////////////////
+// Return a reader over everything written to spool.
+// The spill file is read chunk_cap chars at a time into chunk.
+// Print to stderr and non-zero exit if error.
+struct reader spool_reader(struct spool *const spool, char *const chunk,
+	const size_t chunk_cap)
+{
+	if (spool->spill != NULL) {
+		// Flushes and switches the spill file from writing to reading.
+		if (fseek(spool->spill, 0, SEEK_SET) != 0) {
+			perror("Error: Failed to rewind spill file");
+			exit(1);
+		}
+	}
 
-int main(int argc, char *argv[]) {
-	char target_char = '\\';
-	// First column is 1.
-	size_t target_pos = 80;
-	char fill_char = ' ';
-	// The tab width value to use when calculating line width.
-	size_t tab_width = 4;
+	return (struct reader){spool->mem, spool->mem_len, 0, spool->spill, 0,
+		SIZE_MAX, chunk, chunk_cap, 0, 0, NULL};
+}
 
-	struct maybe_char_ptr maybe_input_path = {false};
+// Return the index in span of the first occurrence of token (or the last,
+//  if last is true), or SIZE_MAX if token does not occur in span.
+// token_len must not be zero.
+size_t find_token(const char *const span, const size_t len,
+	const char *const token, const size_t token_len, const bool last)
+{
+	size_t found = SIZE_MAX;
+	size_t i = 0;
 
-	const char *output_path = NULL;
-	enum output_mode output_mode = OUTPUT_MODE_UNSET;
+	while (i + token_len <= len) {
+		// memchr skips ahead to each candidate first char quickly.
+		const char *const hit = memchr(span + i, token[0],
+			len - token_len + 1 - i);
 
-	// Parse command line arguments.
-	for (int i = 1; i < argc; i += 1) {
-		if (strcmp(argv[i], "--help") == 0) {
-			exit(print_help());
+		if (hit == NULL) {
+			break;
 		}
-		else if (strcmp(argv[i], "--version") == 0) {
-			const int code = fputs(VERSION_STR, stdout);
 
-			if (code != EOF) {
-				exit(0);
-			}
-			else {
-				exit(1);
+		const size_t at = (size_t)(hit - span);
+
+		if (memcmp(hit + 1, token + 1, token_len - 1) == 0) {
+			found = at;
+
+			if (!last) {
+				break;
 			}
 		}
-		else if (
-			(strcmp(argv[i], "-i")      == 0) ||
-			(strcmp(argv[i], "--input") == 0)
-		) {
-			if (i == (argc - 1)) {
-				fprintf(stderr, "Error: The path to the input file must be "
-					"after %s\n", argv[i]);
-				exit(1);
-			}
 
-			if (maybe_input_path.exists) {
-				fprintf(stderr, "Error: Only specify input file once. "
-					"Current input file path: %s", maybe_input_path.value);
-				exit(1);
-			}
+		i = at + 1;
+	}
 
-			maybe_input_path = (struct maybe_char_ptr){true, argv[i + 1]};
+	return found;
+}
 
-			// Jump over the input path.
+// Return which rule applies to line and where its anchor is.
+// rule_i is NO_RULE if no rule applies.
+// Only a line ending in '\n' can be aligned.
+// The char before the '\n' selects an end-of-line rule through
+//  config->rule_index. Otherwise anchors of the other rules are searched for
+//  in rule order.
+struct line_match match_line(const struct align_config *const config,
+	const char *const line, const size_t line_len)
+{
+	struct line_match match = {NO_RULE, 0};
+
+	if (line_len < 2 || line[line_len - 1] != '\n') {
+		return match;
+	}
+
+	match.rule_i = config->rule_index[(unsigned char)line[line_len - 2]];
+
+	if (match.rule_i != NO_RULE) {
+		match.anchor_at = line_len - 2;
+		return match;
+	}
+
+	for (size_t i = 0; i < config->num_mid_rules; i += 1) {
+		const uint8_t rule_i = config->mid_rules[i];
+		const struct align_rule *const rule = &config->rules[rule_i];
+
+		const size_t at = find_token(line, line_len - 1, rule->anchor,
+			rule->anchor_len, rule->anchor_mode == ANCHOR_MODE_LAST);
+
+		if (at != SIZE_MAX) {
+			match.rule_i = rule_i;
+			match.anchor_at = at;
+			return match;
+		}
+	}
+
+	return match;
+}
+
+// Classes of bytes the --cpp-only lexer stops on. Bit flags.
+#define CPP_CLASS_SPACE      0x01
+#define CPP_CLASS_NEWLINE    0x02
+#define CPP_CLASS_BACKSLASH  0x04
+#define CPP_CLASS_SLASH      0x08
+#define CPP_CLASS_STAR       0x10
+#define CPP_CLASS_QUOTE      0x20
+#define CPP_CLASS_APOSTROPHE 0x40
+#define CPP_CLASS_HASH       0x80
+
+// Class of each byte for the --cpp-only lexer. Zero for all other bytes.
+static const uint8_t cpp_class[256] = {
+	[' ']  = CPP_CLASS_SPACE,
+	['\t'] = CPP_CLASS_SPACE,
+	['\r'] = CPP_CLASS_SPACE,
+	['\f'] = CPP_CLASS_SPACE,
+	['\v'] = CPP_CLASS_SPACE,
+	['\n'] = CPP_CLASS_NEWLINE,
+	['\\'] = CPP_CLASS_BACKSLASH,
+	['/']  = CPP_CLASS_SLASH,
+	['*']  = CPP_CLASS_STAR,
+	['"']  = CPP_CLASS_QUOTE,
+	['\''] = CPP_CLASS_APOSTROPHE,
+	['#']  = CPP_CLASS_HASH
+};
+
+// Classes of bytes that can change the lexer's state, by state.
+// The lexer skips over runs of other bytes without looking at them further.
+static const uint8_t cpp_stop_classes[] = {
+	[CPP_STATE_CODE] = (uint8_t)~CPP_CLASS_SPACE,
+	[CPP_STATE_STRING] =
+		CPP_CLASS_NEWLINE | CPP_CLASS_BACKSLASH | CPP_CLASS_QUOTE,
+	[CPP_STATE_CHAR] =
+		CPP_CLASS_NEWLINE | CPP_CLASS_BACKSLASH | CPP_CLASS_APOSTROPHE,
+	[CPP_STATE_BLOCK_COMMENT] =
+		CPP_CLASS_NEWLINE | CPP_CLASS_STAR | CPP_CLASS_SLASH,
+	[CPP_STATE_LINE_COMMENT] = CPP_CLASS_NEWLINE | CPP_CLASS_BACKSLASH
+};
+
+// Feed len bytes of span to lexer.
+void cpp_scan(struct cpp_lexer *const lexer, const char *const span,
+	const size_t len)
+{
+	size_t i = 0;
+
+	while (i < len) {
+		// Skip bytes that cannot change the state.
+		// In code, whitespace only matters before a possible '#'.
+		// Right after a backslash in a literal, every byte matters.
+		if (!(lexer->state == CPP_STATE_CODE && lexer->at_line_start) &&
+			!lexer->escaped)
+		{
+			const uint8_t stop = cpp_stop_classes[lexer->state];
+			const size_t start = i;
+
+			while (i < len && !(cpp_class[(unsigned char)span[i]] & stop)) {
+				i += 1;
+			}
+
+			if (i > start) {
+				lexer->prev = span[i - 1];
+			}
+
+			if (i == len) {
+				break;
+			}
+		}
+
+		const char ch = span[i];
+		i += 1;
+
+		if (ch == '\n') {
+			if (lexer->prev == '\\') {
+				// Backslash-newline joins the next line onto this one,
+				//  even inside a literal or comment. The backslash
+				//  escapes nothing.
+				if (lexer->state == CPP_STATE_STRING ||
+					lexer->state == CPP_STATE_CHAR)
+				{
+					lexer->escaped = !lexer->escaped;
+				}
+			}
+			else {
+				// End of the logical line.
+				if (lexer->state != CPP_STATE_BLOCK_COMMENT) {
+					lexer->state = CPP_STATE_CODE;
+				}
+
+				lexer->in_directive = false;
+				lexer->at_line_start = true;
+				lexer->escaped = false;
+			}
+
+			lexer->prev = ch;
+			continue;
+		}
+
+		switch (lexer->state) {
+			case CPP_STATE_CODE:
+			{
+				if (lexer->prev == '/' && (ch == '*' || ch == '/')) {
+					lexer->state = (ch == '*')
+						? CPP_STATE_BLOCK_COMMENT
+						: CPP_STATE_LINE_COMMENT;
+
+					// So "/*/" does not end the comment.
+					lexer->prev = '\0';
+					continue;
+				}
+				else if (ch == '"') {
+					lexer->state = CPP_STATE_STRING;
+				}
+				else if (ch == '\'') {
+					lexer->state = CPP_STATE_CHAR;
+				}
+				else if (ch == '#' && lexer->at_line_start) {
+					lexer->in_directive = true;
+				}
+
+				if (!(cpp_class[(unsigned char)ch] & CPP_CLASS_SPACE)) {
+					lexer->at_line_start = false;
+				}
+
+				break;
+			}
+			case CPP_STATE_STRING:
+			case CPP_STATE_CHAR:
+			{
+				const char close =
+					(lexer->state == CPP_STATE_STRING) ? '"' : '\'';
+
+				if (lexer->escaped) {
+					lexer->escaped = false;
+				}
+				else if (ch == '\\') {
+					lexer->escaped = true;
+				}
+				else if (ch == close) {
+					lexer->state = CPP_STATE_CODE;
+				}
+
+				break;
+			}
+			case CPP_STATE_BLOCK_COMMENT:
+			{
+				if (lexer->prev == '*' && ch == '/') {
+					lexer->state = CPP_STATE_CODE;
+
+					// So "*/*" does not start a comment.
+					lexer->prev = '\0';
+					continue;
+				}
+
+				break;
+			}
+			case CPP_STATE_LINE_COMMENT: break;
+		}
+
+		lexer->prev = ch;
+	}
+}
+
+// Feed line of length line_len to lexer.
+// For --cpp-only, return match unchanged if it is by an ANCHOR_MODE_END rule
+//  whose anchor continues a preprocessor directive outside of any comment
+//  or literal, or return a match of no rule if not.
+// Matches by other rules are returned unchanged.
+struct line_match cpp_filter_line(struct cpp_lexer *const lexer,
+	const struct align_config *const config, const char *const line,
+	const size_t line_len, struct line_match match)
+{
+	if (match.rule_i == NO_RULE ||
+		config->rules[match.rule_i].anchor_mode != ANCHOR_MODE_END)
+	{
+		cpp_scan(lexer, line, line_len);
+		return match;
+	}
+
+	cpp_scan(lexer, line, match.anchor_at);
+
+	if (!lexer->in_directive || lexer->state != CPP_STATE_CODE) {
+		match.rule_i = NO_RULE;
+	}
+
+	cpp_scan(lexer, line + match.anchor_at, line_len - match.anchor_at);
+
+	return match;
+}
+
+// Copy from in into out through the next '\n', feeding the copied bytes to
+//  lexer.
+// Return true if '\n' found.
+// Return false if EOF reached before '\n' found.
+// Prints to stderr and non-zero exits if file error.
+bool transfer_scanned(struct reader *const in, FILE *const out,
+	struct cpp_lexer *const lexer)
+{
+	while (true) {
+		char buf[BUF_CAP];
+		size_t buf_len;
+		const uint8_t result = read_through_char(in, buf, BUF_CAP, '\n',
+			&buf_len);
+
+		ensure_fwriten(out, buf, buf_len);
+		cpp_scan(lexer, buf, buf_len);
+
+		if (result != RTC_BUF_FULL) {
+			return result == RTC_SUCCESS;
+		}
+	}
+}
+
+// Return true if span is num_tabs tabs followed by num_fill fill_chars.
+bool span_is_padding(const char *const span, const size_t num_tabs,
+	const size_t num_fill, const char fill_char)
+{
+	for (size_t i = 0; i < num_tabs; i += 1) {
+		if (span[i] != '\t') {
+			return false;
+		}
+	}
+
+	for (size_t i = num_tabs; i < num_tabs + num_fill; i += 1) {
+		if (span[i] != fill_char) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Write count copies of ch into file.
+// Print to stderr and non-zero exit if error.
+void write_fill(FILE *const file, const char ch, size_t count) {
+	char fill[64];
+	memset(fill, ch, sizeof(fill));
+
+	while (count > 0) {
+		const size_t len = (count < sizeof(fill)) ? count : sizeof(fill);
+		ensure_fwriten(file, fill, len);
+		count -= len;
+	}
+}
+
+// Return len, less the padding at the end of the first len chars of span
+//  that --realign strips (if --realign was given).
+size_t strip_padding(const char *const span, size_t len, const char fill_char,
+	const struct align_config *const config)
+{
+	if (config->realign) {
+		while (len > 0 && (span[len - 1] == fill_char ||
+			(config->fill_tabs && span[len - 1] == '\t')))
+		{
+			len -= 1;
+		}
+	}
+
+	return len;
+}
+
+// Return the width of line through the first char of the anchor at index
+//  anchor_at, not counting padding that --realign strips.
+// This is the column the anchor starts on.
+size_t get_matched_width(const char *const line, const size_t anchor_at,
+	const struct align_rule *const rule,
+	const struct align_config *const config)
+{
+	const size_t content_len = strip_padding(line, anchor_at, rule->fill_char,
+		config);
+
+	return get_span_width(line, content_len, config->tab_width)
+		+ get_span_width(line + anchor_at, 1, config->tab_width);
+}
+
+// Write line of length line_len into output with the anchor at index
+//  anchor_at aligned to the rule's target position.
+// Lines where the anchor is already past the target position are written
+//  unchanged, unless --realign strips their padding. Then a single fill char
+//  is kept between the content and the anchor.
+// Counts are added to stats under rule_i.
+void align_line(FILE *const output, const char *const line,
+	const size_t line_len, const size_t anchor_at,
+	const struct align_rule *const rule, const uint8_t rule_i,
+	const struct align_config *const config, struct align_stats *const stats)
+{
+	const size_t content_len = strip_padding(line, anchor_at, rule->fill_char,
+		config);
+	const char *const old_pad = line + content_len;
+	const size_t old_pad_len = anchor_at - content_len;
+	const size_t line_width = get_matched_width(line, anchor_at, rule,
+		config);
+
+	// The new padding is num_tabs tabs followed by num_fill fill chars.
+	size_t num_tabs = 0;
+	size_t num_fill;
+	if (line_width > rule->target_pos) {
+		stats->num_past += 1;
+		num_fill = (old_pad_len > 0) ? 1 : 0;
+	}
+	else {
+		num_fill = rule->target_pos - line_width;
+
+		if (config->fill_tabs && config->tab_width > 0) {
+			// Same tab model as get_span_width.
+			num_tabs = num_fill / config->tab_width;
+			num_fill = num_fill % config->tab_width;
+		}
+	}
+
+	if (old_pad_len == num_tabs + num_fill &&
+		span_is_padding(old_pad, num_tabs, num_fill, rule->fill_char))
+	{
+		// Nothing for us to do except write out line.
+		ensure_fwriten(output, line, line_len);
+		return;
+	}
+
+	// Args: column the anchor was on, column it is moved to, padding chars.
+	TRACEPOINT3(line_aligned, line_width, rule->target_pos,
+		num_tabs + num_fill);
+
+	stats->num_aligned[rule_i] += 1;
+	stats->pad_written += num_tabs + num_fill;
+	stats->pad_removed += old_pad_len;
+
+	// Write out line up to the old padding.
+	ensure_fwriten(output, line, content_len);
+
+	write_fill(output, '\t', num_tabs);
+	write_fill(output, rule->fill_char, num_fill);
+
+	// Write out the anchor and everything after it.
+	ensure_fwriten(output, line + anchor_at, line_len - anchor_at);
+}
+
+// Write out the lines held in block and stop holding them.
+// They are aligned to the widest of them, or to DEFAULT_TARGET_POS if the
+//  run has overflowed.
+// Counts are added to stats.
+void flush_block(FILE *const output, struct block *const block,
+	const struct align_config *const config, struct align_stats *const stats)
+{
+	if (block->len == 0) {
+		return;
+	}
+
+	struct align_rule rule = config->rules[block->rule_i];
+	rule.target_pos = block->overflowed
+		? DEFAULT_TARGET_POS
+		: block->max_width + rule.pos_offset;
+
+	const char *line = block->mem;
+	const char *const end = block->mem + block->len;
+
+	while (line < end) {
+		// Every held line ends in '\n'.
+		const char *const newline = memchr(line, '\n', (size_t)(end - line));
+		const size_t line_len = (size_t)(newline - line) + 1;
+
+		// Held lines were matched by block->rule_i, so match again to find
+		//  the anchor.
+		const struct line_match match = match_line(config, line, line_len);
+
+		align_line(output, line, line_len, match.anchor_at, &rule,
+			block->rule_i, config, stats);
+
+		line += line_len;
+	}
+
+	block->len = 0;
+}
+
+// End the current run of lines (if any), writing out any held lines.
+// Counts are added to stats.
+void end_block(FILE *const output, struct block *const block,
+	const struct align_config *const config, struct align_stats *const stats)
+{
+	if (block->rule_i == NO_RULE) {
+		return;
+	}
+
+	flush_block(output, block, config, stats);
+
+	block->rule_i = NO_RULE;
+	block->max_width = 0;
+	block->overflowed = false;
+}
+
+// Align a line matched by a POSITION_MODE_BLOCK rule.
+// The line is held in block until its run of lines ends, unless the run
+//  is too long to hold.
+// Counts are added to stats.
+void block_line(FILE *const output, struct block *const block,
+	const char *const line, const size_t line_len,
+	const struct line_match match, const struct align_config *const config,
+	struct align_stats *const stats)
+{
+	const struct align_rule *const rule = &config->rules[match.rule_i];
+
+	if (block->rule_i != match.rule_i) {
+		end_block(output, block, config, stats);
+		block->rule_i = match.rule_i;
+	}
+
+	if (!block->overflowed && block->len + line_len > config->block_cap) {
+		// Fall back to the fixed column for this whole run.
+		block->overflowed = true;
+		flush_block(output, block, config, stats);
+	}
+
+	if (block->overflowed) {
+		struct align_rule fallback = *rule;
+		fallback.target_pos = DEFAULT_TARGET_POS;
+
+		align_line(output, line, line_len, match.anchor_at, &fallback,
+			match.rule_i, config, stats);
+
+		return;
+	}
+
+	memcpy(block->mem + block->len, line, line_len);
+	block->len += line_len;
+
+	const size_t width = get_matched_width(line, match.anchor_at, rule,
+		config);
+	if (width > block->max_width) {
+		block->max_width = width;
+	}
+}
+
+// Read all lines from input, align them according to config,
+//  and write them to output.
+// Counts are added to stats.
+// Prints to stderr and non-zero exits if file error.
+void align_stream(struct reader *const input, FILE *const output,
+	const struct align_config *const config, struct align_stats *const stats)
+{
+	// Not static: worker threads align files concurrently.
+	char block_mem[BLOCK_CAP];
+	struct block block = {block_mem, 0, NO_RULE, 0, false};
+	struct cpp_lexer lexer = {CPP_STATE_CODE, false, true, false, '\n'};
+
+	while (true) {
+		char buf[BUF_CAP];
+		size_t buf_len;
+		const uint8_t result = read_through_char(input, buf, BUF_CAP, '\n',
+			&buf_len);
+		PROGRESS_NOTE(input);
+
+		if (result == RTC_SUCCESS || result == RTC_EOF_REACHED) {
+			if (buf_len > 0) {
+				stats->num_lines += 1;
+			}
+
+			struct line_match match = match_line(config, buf, buf_len);
+
+			if (config->cpp_only) {
+				match = cpp_filter_line(&lexer, config, buf, buf_len, match);
+			}
+
+			if (block.rule_i != match.rule_i) {
+				// The run of held lines (if any) has ended.
+				end_block(output, &block, config, stats);
+			}
+
+			if (match.rule_i == NO_RULE) {
+				// Simply write line out.
+				ensure_fwriten(output, buf, buf_len);
+			}
+			else if (config->rules[match.rule_i].pos_mode ==
+				POSITION_MODE_BLOCK)
+			{
+				stats->num_matched[match.rule_i] += 1;
+				block_line(output, &block, buf, buf_len, match, config,
+					stats);
+			}
+			else {
+				stats->num_matched[match.rule_i] += 1;
+				align_line(output, buf, buf_len, match.anchor_at,
+					&config->rules[match.rule_i], match.rule_i, config,
+					stats);
+			}
+
+			if (result == RTC_EOF_REACHED) {
+				// All lines handled.
+				break;
+			}
+		}
+		else if (result == RTC_BUF_FULL) {
+			// Line is too long. It ends any run of held lines.
+			stats->num_lines += 1;
+			stats->num_long_lines += 1;
+
+			// Args: bytes of the line taken so far.
+			TRACEPOINT1(long_line, buf_len);
+
+			end_block(output, &block, config, stats);
+
+			// We just write it out and walk past the rest of it.
+			ensure_fwriten(output, buf, buf_len);
+
+			if (config->cpp_only) {
+				// The lexer must see every byte, so walk the rest of the
+				//  line in bufs instead.
+				cpp_scan(&lexer, buf, buf_len);
+				if (!transfer_scanned(input, output, &lexer)) {
+					// EOF reached. All done.
+					break;
+				}
+			}
+			else if (!transfer_through_char(input, output, '\n')) {
+				// EOF reached. All done.
+				break;
+			}
+		}
+		else {
+			fprintf(stderr, "Unknown RTC error: %d\n", result);
+			exit(1);
+		}
+	}
+
+	end_block(output, &block, config, stats);
+}
+
+// Read all lines from input into spool, recording in max_width the width of
+//  the widest line matched by each rule.
+// max_width must have config->num_rules elements, each initially zero.
+// Lines too long to align are spooled but not measured.
+// Prints to stderr and non-zero exits if file error.
+void measure_stream(struct reader *const input, struct spool *const spool,
+	const struct align_config *const config, size_t *const max_width)
+{
+	struct cpp_lexer lexer = {CPP_STATE_CODE, false, true, false, '\n'};
+	bool in_long_line = false;
+
+	while (true) {
+		char buf[BUF_CAP];
+		size_t buf_len;
+		const uint8_t result = read_through_char(input, buf, BUF_CAP, '\n',
+			&buf_len);
+		PROGRESS_NOTE(input);
+
+		spool_write(spool, buf, buf_len);
+
+		if (result == RTC_BUF_FULL) {
+			// The rest of the line follows in the next buf(s).
+			in_long_line = true;
+
+			if (config->cpp_only) {
+				cpp_scan(&lexer, buf, buf_len);
+			}
+
+			continue;
+		}
+		else if (result != RTC_SUCCESS && result != RTC_EOF_REACHED) {
+			fprintf(stderr, "Unknown RTC error: %d\n", result);
+			exit(1);
+		}
+
+		struct line_match match = match_line(config, buf, buf_len);
+
+		if (config->cpp_only) {
+			match = cpp_filter_line(&lexer, config, buf, buf_len, match);
+		}
+
+		if (!in_long_line && match.rule_i != NO_RULE) {
+			const size_t width = get_matched_width(buf, match.anchor_at,
+				&config->rules[match.rule_i], config);
+
+			if (width > max_width[match.rule_i]) {
+				max_width[match.rule_i] = width;
+			}
+		}
+
+		in_long_line = false;
+
+		if (result == RTC_EOF_REACHED) {
+			break;
+		}
+	}
+}
+
+// Read all lines from input into spool, recording in column_width the width
+//  of the widest field before each occurrence of the --columns char.
+// column_width must have MAX_COLUMNS elements, each initially zero.
+// Lines too long to align are spooled but not measured.
+// Prints to stderr and non-zero exits if file error.
+void measure_columns(struct reader *const input, struct spool *const spool,
+	const struct align_config *const config, size_t *const column_width)
+{
+	const char fill_char = config->rules[0].fill_char;
+	bool in_long_line = false;
+
+	while (true) {
+		char buf[BUF_CAP];
+		size_t buf_len;
+		const uint8_t result = read_through_char(input, buf, BUF_CAP, '\n',
+			&buf_len);
+		PROGRESS_NOTE(input);
+
+		spool_write(spool, buf, buf_len);
+
+		if (result == RTC_BUF_FULL) {
+			// The rest of the line follows in the next buf(s).
+			in_long_line = true;
+			continue;
+		}
+		else if (result != RTC_SUCCESS && result != RTC_EOF_REACHED) {
+			fprintf(stderr, "Unknown RTC error: %d\n", result);
+			exit(1);
+		}
+
+		const char *field = buf;
+		const char *const end = buf + buf_len;
+
+		for (size_t col = 0; !in_long_line && col < MAX_COLUMNS; col += 1) {
+			const char *const delim = memchr(field, config->columns_char,
+				(size_t)(end - field));
+
+			if (delim == NULL) {
+				break;
+			}
+
+			const size_t field_len = strip_padding(field,
+				(size_t)(delim - field), fill_char, config);
+			const size_t width = get_span_width(field, field_len,
+				config->tab_width);
+
+			if (width > column_width[col]) {
+				column_width[col] = width;
+			}
+
+			field = delim + 1;
+		}
+
+		in_long_line = false;
+
+		if (result == RTC_EOF_REACHED) {
+			break;
+		}
+	}
+}
+
+// Read all lines from input and write them to output with each occurrence
+//  of the --columns char aligned to the column_width measured by
+//  measure_columns.
+// Counts of lines with at least one --columns char are added to the first
+//  rule in stats.
+// Prints to stderr and non-zero exits if file error.
+void align_columns(struct reader *const input, FILE *const output,
+	const struct align_config *const config, const size_t *const column_width,
+	struct align_stats *const stats)
+{
+	const char fill_char = config->rules[0].fill_char;
+
+	while (true) {
+		char buf[BUF_CAP];
+		size_t buf_len;
+		const uint8_t result = read_through_char(input, buf, BUF_CAP, '\n',
+			&buf_len);
+		PROGRESS_NOTE(input);
+
+		if (result == RTC_BUF_FULL) {
+			// Line is too long.
+			// We just write it out and walk past the rest of it.
+			stats->num_lines += 1;
+			stats->num_long_lines += 1;
+			ensure_fwriten(output, buf, buf_len);
+
+			if (!transfer_through_char(input, output, '\n')) {
+				// EOF reached. All done.
+				break;
+			}
+
+			continue;
+		}
+		else if (result != RTC_SUCCESS && result != RTC_EOF_REACHED) {
+			fprintf(stderr, "Unknown RTC error: %d\n", result);
+			exit(1);
+		}
+
+		if (buf_len > 0) {
+			stats->num_lines += 1;
+		}
+
+		const char *field = buf;
+		const char *const end = buf + buf_len;
+		bool changed = false;
+
+		for (size_t col = 0; col < MAX_COLUMNS; col += 1) {
+			const char *const delim = memchr(field, config->columns_char,
+				(size_t)(end - field));
+
+			if (delim == NULL) {
+				break;
+			}
+
+			if (col == 0) {
+				stats->num_matched[0] += 1;
+			}
+
+			const size_t old_len = (size_t)(delim - field);
+			const size_t field_len = strip_padding(field, old_len, fill_char,
+				config);
+			const size_t width = get_span_width(field, field_len,
+				config->tab_width);
+			const size_t num_fill = column_width[col] - width;
+
+			if (old_len != field_len + num_fill ||
+				!span_is_padding(field + field_len, 0, num_fill, fill_char))
+			{
+				changed = true;
+				stats->pad_written += num_fill;
+				stats->pad_removed += old_len - field_len;
+			}
+
+			ensure_fwriten(output, field, field_len);
+			write_fill(output, fill_char, num_fill);
+			ensure_fwriten(output, delim, 1);
+
+			field = delim + 1;
+		}
+
+		// Write out whatever follows the last aligned delimiter.
+		ensure_fwriten(output, field, (size_t)(end - field));
+
+		if (changed) {
+			stats->num_aligned[0] += 1;
+		}
+
+		if (result == RTC_EOF_REACHED) {
+			break;
+		}
+	}
+}
+
+// Return seconds elapsed on a monotonic clock since some fixed point.
+// Where POSIX is not available, only whole seconds of calendar time.
+double wall_seconds(void) {
+#if ALIGNCHAR_POSIX
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+	return (double)time(NULL);
+#endif
+}
+
+// Return seconds of processor time used by the process.
+double cpu_seconds(void) {
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+// Return the peak resident set size of the process in KiB, or 0 if unknown.
+long peak_rss_kib(void) {
+#if ALIGNCHAR_POSIX
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		// Bytes on macOS.
+		return usage.ru_maxrss / 1024;
+#else
+		return usage.ru_maxrss;
+#endif
+	}
+#endif
+
+	return 0;
+}
+
+// Names of the phases, for printing.
+static const char *const phase_names[NUM_PHASES] = {
+	"open", "measure", "align", "close"
+};
+
+// Per-thread --trace events. Index 0 is the main thread, 1 and up workers.
+static struct trace_ring trace_rings[MAX_JOBS + 1];
+
+// Whether --trace was given, and wall_seconds() when it was.
+static bool trace_enabled = false;
+static double trace_epoch = 0;
+
+// File descriptors of the open --perf-counters counters, -1 where not open.
+static int perf_fds[NUM_PERF_COUNTERS] = {-1, -1, -1, -1};
+
+// Open the hardware performance counters for this process (and threads it
+//  starts afterward).
+// Counters that cannot be opened (such as in a container that does not
+//  allow them) are left closed.
+// Return the number of counters opened. If zero, errno is from the last
+//  attempt.
+size_t perf_counters_open(void) {
+	size_t num_open = 0;
+
+#if ALIGNCHAR_PERF
+	static const uint64_t configs[NUM_PERF_COUNTERS] = {
+		[PERF_COUNTER_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+		[PERF_COUNTER_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+		[PERF_COUNTER_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+		[PERF_COUNTER_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES
+	};
+
+	for (size_t i = 0; i < NUM_PERF_COUNTERS; i += 1) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = configs[i];
+		attr.inherit = 1;
+		// Allowed at the default perf_event_paranoid level.
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		const long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+		if (fd >= 0) {
+			perf_fds[i] = (int)fd;
+			ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+			num_open += 1;
+		}
+	}
+#else
+	errno = ENOSYS;
+#endif
+
+	return num_open;
+}
+
+// Read the current value of each open counter into values.
+// Closed counters read as zero.
+void perf_counters_read(uint64_t *const values) {
+	for (size_t i = 0; i < NUM_PERF_COUNTERS; i += 1) {
+		values[i] = 0;
+
+#if ALIGNCHAR_PERF
+		if (perf_fds[i] >= 0) {
+			uint64_t value;
+			if (read(perf_fds[i], &value, sizeof(value)) == sizeof(value)) {
+				values[i] = value;
+			}
+		}
+#endif
+	}
+}
+
+// Record a span from start to end (from wall_seconds) named name (a string
+//  literal) for the file at path, by thread (0 for the main thread, else a
+//  worker index from 1).
+// Each thread only records into its own ring, so no locking is needed.
+// Does nothing unless --trace was given.
+void trace_span(const size_t thread, const char *const name,
+	const char *const path, const double start, const double end)
+{
+	if (!trace_enabled) {
+		return;
+	}
+
+	struct trace_ring *const ring = &trace_rings[thread];
+	struct trace_event *const event =
+		&ring->events[ring->count % TRACE_RING_CAP];
+
+	const size_t path_len = strlen(path);
+	const size_t skip = (path_len >= TRACE_PATH_CAP)
+		? path_len - (TRACE_PATH_CAP - 1)
+		: 0;
+
+	event->name = name;
+	memcpy(event->path, path + skip, path_len - skip + 1);
+	event->start = start - trace_epoch;
+	event->end = end - trace_epoch;
+
+	ring->count += 1;
+}
+
+// Write str to stream as the contents of a JSON string.
+void write_json_string(FILE *const stream, const char *str) {
+	for (; str[0] != '\0'; str += 1) {
+		const unsigned char ch = (unsigned char)str[0];
+
+		if (ch == '"' || ch == '\\') {
+			fprintf(stream, "\\%c", ch);
+		}
+		else if (ch < 0x20) {
+			fprintf(stream, "\\u%04x", ch);
+		}
+		else {
+			fputc(ch, stream);
+		}
+	}
+}
+
+// Write every recorded --trace event to the file at path as Chrome
+//  trace-event JSON.
+// Print to stderr and return false if the file cannot be written.
+bool write_trace(const char *const path) {
+	FILE *const file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Error: Failed to open trace file: %s\n", path);
+		return false;
+	}
+
+#if ALIGNCHAR_POSIX
+	const long pid = (long)getpid();
+#else
+	const long pid = 1;
+#endif
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	bool first = true;
+	for (size_t thread = 0; thread < MAX_JOBS + 1; thread += 1) {
+		const struct trace_ring *const ring = &trace_rings[thread];
+		const size_t num_kept = (ring->count < TRACE_RING_CAP)
+			? ring->count
+			: TRACE_RING_CAP;
+
+		for (size_t i = ring->count - num_kept; i < ring->count; i += 1) {
+			const struct trace_event *const event =
+				&ring->events[i % TRACE_RING_CAP];
+
+			fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"alignchar\","
+				"\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,"
+				"\"tid\":%zu,\"args\":{\"file\":\"", first ? "" : ",",
+				event->name, event->start * 1e6,
+				(event->end - event->start) * 1e6, pid, thread);
+			write_json_string(file, event->path);
+			fprintf(file, "\"}}");
+
+			first = false;
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+
+	if (ferror(file) != 0 || fclose(file) != 0) {
+		fprintf(stderr, "Error: Failed to write trace file: %s\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+#if ALIGNCHAR_POSIX
+// Thread printing --progress to stderr at a fixed interval.
+struct progress_reporter {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+	// Set to stop the thread.
+	bool stop;
+
+	// Size of the input in chars, or 0 if unknown.
+	size_t total;
+	// Whether a progress line has been printed.
+	bool printed;
+};
+
+// Format num_bytes into buf (of capacity cap) with a binary unit.
+void format_bytes(char *const buf, const size_t cap, const size_t num_bytes) {
+	static const char *const units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+	double value = (double)num_bytes;
+	size_t unit = 0;
+
+	while (value >= 1024 && unit < (sizeof(units) / sizeof(units[0])) - 1) {
+		value /= 1024;
+		unit += 1;
+	}
+
+	snprintf(buf, cap, "%.1f %s", value, units[unit]);
+}
+
+// Print one --progress line (overwriting the last) to stderr.
+// done is chars consumed in phase after elapsed seconds.
+void print_progress(struct progress_reporter *const reporter,
+	const int phase, const size_t done, const double elapsed)
+{
+	char done_str[32];
+	format_bytes(done_str, sizeof(done_str), done);
+
+	const double mb_per_s = (elapsed > 0) ? (double)done / 1e6 / elapsed : 0;
+
+	fprintf(stderr, "\r[%s] %s", phase_names[phase], done_str);
+
+	if (reporter->total > 0) {
+		char total_str[32];
+		format_bytes(total_str, sizeof(total_str), reporter->total);
+
+		fprintf(stderr, " / %s (%.1f%%)", total_str,
+			100.0 * (double)done / (double)reporter->total);
+	}
+
+	fprintf(stderr, ", %.1f MB/s", mb_per_s);
+
+	if (reporter->total > 0 && done > 0 && done <= reporter->total) {
+		const double eta = elapsed * (double)(reporter->total - done)
+			/ (double)done;
+		fprintf(stderr, ", ETA %.0f s", eta);
+	}
+
+	// Clear what is left of a longer previous line.
+	fprintf(stderr, "     ");
+	reporter->printed = true;
+}
+
+// Print progress every PROGRESS_INTERVAL_MS until told to stop.
+void *progress_main(void *const arg) {
+	struct progress_reporter *const reporter = arg;
+
+	int last_phase = -1;
+	double phase_began = 0;
+
+	pthread_mutex_lock(&reporter->mutex);
+
+	while (!reporter->stop) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += (long)PROGRESS_INTERVAL_MS * 1000000L;
+		until.tv_sec += until.tv_nsec / 1000000000L;
+		until.tv_nsec %= 1000000000L;
+
+		pthread_cond_timedwait(&reporter->wake, &reporter->mutex, &until);
+
+		if (reporter->stop) {
+			break;
+		}
+
+		const int phase = RELAXED_LOAD(&progress_phase);
+		const size_t done = RELAXED_LOAD(&progress_done);
+
+		if (phase != last_phase) {
+			last_phase = phase;
+			phase_began = wall_seconds();
+		}
+
+		if (phase == PHASE_MEASURE || phase == PHASE_ALIGN) {
+			print_progress(reporter, phase, done,
+				wall_seconds() - phase_began);
+		}
+	}
+
+	pthread_mutex_unlock(&reporter->mutex);
+	return NULL;
+}
+
+// Start printing --progress for an input of total chars (0 if unknown).
+// Print to stderr and return false if the thread cannot be started.
+bool progress_start(struct progress_reporter *const reporter,
+	const size_t total)
+{
+	reporter->stop = false;
+	reporter->total = total;
+	reporter->printed = false;
+
+	if (pthread_mutex_init(&reporter->mutex, NULL) != 0 ||
+		pthread_cond_init(&reporter->wake, NULL) != 0 ||
+		pthread_create(&reporter->thread, NULL, progress_main, reporter) != 0)
+	{
+		fprintf(stderr, "Warning: Failed to start progress thread. "
+			"Continuing without progress.\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Stop the thread started by progress_start, ending its line of output.
+void progress_stop(struct progress_reporter *const reporter) {
+	pthread_mutex_lock(&reporter->mutex);
+	reporter->stop = true;
+	pthread_cond_signal(&reporter->wake);
+	pthread_mutex_unlock(&reporter->mutex);
+
+	pthread_join(reporter->thread, NULL);
+
+	if (reporter->printed) {
+		fprintf(stderr, "\n");
+	}
+}
+#endif
+
+// Start timing a phase.
+void phase_start(struct phase_times *const times, const enum phase phase) {
+	uint64_t events[NUM_PERF_COUNTERS];
+	perf_counters_read(events);
+
+	for (size_t i = 0; i < NUM_PERF_COUNTERS; i += 1) {
+		times->events[phase][i] -= events[i];
+	}
+
+	times->begun_wall = wall_seconds();
+	times->begun_cpu = cpu_seconds();
+
+	if (times->show_progress) {
+		RELAXED_STORE(&progress_done, (size_t)0);
+		RELAXED_STORE(&progress_phase, (int)phase);
+	}
+}
+
+// Stop timing a phase started with phase_start.
+void phase_stop(struct phase_times *const times, const enum phase phase) {
+	const double wall = wall_seconds();
+
+	times->wall[phase] += wall - times->begun_wall;
+	times->cpu[phase] += cpu_seconds() - times->begun_cpu;
+
+	trace_span(times->trace_thread, phase_names[phase], times->path,
+		times->begun_wall, wall);
+
+	uint64_t events[NUM_PERF_COUNTERS];
+	perf_counters_read(events);
+
+	for (size_t i = 0; i < NUM_PERF_COUNTERS; i += 1) {
+		times->events[phase][i] += events[i];
+	}
+}
+
+// Align everything from input according to config and write it to output,
+//  timing the phases in times.
+// -p auto and --columns need two passes, so for them the input is held in
+//  spool_mem (of capacity spool_cap), spilling to a temporary file, and
+//  auto positions are set in config.
+// Counts are added to stats.
+// Prints to stderr and non-zero exits if file error.
+void align_input(struct reader *const input, FILE *const output,
+	struct align_config *const config, char *const spool_mem,
+	const size_t spool_cap, struct align_stats *const stats,
+	struct phase_times *const times)
+{
+	bool any_auto = false;
+	for (size_t i = 0; i < config->num_rules; i += 1) {
+		any_auto |= config->rules[i].pos_mode == POSITION_MODE_AUTO;
+	}
+
+	if (!any_auto && !config->columns) {
+		phase_start(times, PHASE_ALIGN);
+		align_stream(input, output, config, stats);
+		phase_stop(times, PHASE_ALIGN);
+		return;
+	}
+
+	// Read the input once, holding on to it while measuring,
+	//  then align from what was held.
+	struct spool spool = {spool_mem, spool_cap, 0, NULL};
+
+	if (config->columns) {
+		size_t column_width[MAX_COLUMNS] = {0};
+
+		phase_start(times, PHASE_MEASURE);
+		measure_columns(input, &spool, config, column_width);
+		phase_stop(times, PHASE_MEASURE);
+
+		phase_start(times, PHASE_ALIGN);
+		// The input has been read to its end, so its chunk is free.
+		struct reader spooled = spool_reader(&spool, input->chunk,
+			input->chunk_cap);
+		spooled.progress = input->progress;
+		align_columns(&spooled, output, config, column_width, stats);
+		phase_stop(times, PHASE_ALIGN);
+	}
+	else {
+		size_t max_width[MAX_RULES] = {0};
+
+		phase_start(times, PHASE_MEASURE);
+		measure_stream(input, &spool, config, max_width);
+		phase_stop(times, PHASE_MEASURE);
+
+		for (size_t i = 0; i < config->num_rules; i += 1) {
+			struct align_rule *const rule = &config->rules[i];
+
+			if (rule->pos_mode == POSITION_MODE_AUTO) {
+				rule->target_pos = max_width[i] + rule->pos_offset;
+			}
+		}
+
+		phase_start(times, PHASE_ALIGN);
+		// The input has been read to its end, so its chunk is free.
+		struct reader spooled = spool_reader(&spool, input->chunk,
+			input->chunk_cap);
+		spooled.progress = input->progress;
+		align_stream(&spooled, output, config, stats);
+		phase_stop(times, PHASE_ALIGN);
+	}
+
+	if (spool.spill != NULL && fclose(spool.spill) != 0) {
+		fprintf(stderr, "Failed to properly close spill file\n");
+	}
+}
+
+// Print to stream the hardware events counted in each phase for the file
+//  at path (--perf-counters).
+void print_perf_counters(FILE *const stream, const char *const path,
+	const struct phase_times *const times)
+{
+	fprintf(stream, "Perf counters for %s:\n", path);
+	fprintf(stream, "%-8s %16s %16s %16s %16s\n", "phase", "cycles",
+		"instructions", "branch-misses", "cache-misses");
+
+	for (size_t phase = 0; phase < NUM_PHASES; phase += 1) {
+		fprintf(stream, "%-8s", phase_names[phase]);
+
+		for (size_t i = 0; i < NUM_PERF_COUNTERS; i += 1) {
+			if (perf_fds[i] >= 0) {
+				fprintf(stream, " %16llu",
+					(unsigned long long)times->events[phase][i]);
+			}
+			else {
+				fprintf(stream, " %16s", "n/a");
+			}
+		}
+
+		fprintf(stream, "\n");
+	}
+}
+
+// Print to stream what a run did (--stats), as JSON if json is true.
+// bytes_read is the number of chars read from the input file.
+void print_stats(FILE *const stream, const bool json,
+	const struct align_config *const config,
+	const struct align_stats *const stats,
+	const struct phase_times *const times, const size_t bytes_read)
+{
+	// The engine only adds or removes padding.
+	const size_t bytes_written =
+		bytes_read + stats->pad_written - stats->pad_removed;
+
+	size_t num_matched = 0;
+	size_t num_aligned = 0;
+	for (size_t i = 0; i < config->num_rules; i += 1) {
+		num_matched += stats->num_matched[i];
+		num_aligned += stats->num_aligned[i];
+	}
+
+	double total_wall = 0;
+	for (size_t i = 0; i < NUM_PHASES; i += 1) {
+		total_wall += times->wall[i];
+	}
+
+	const double mb_per_s = (total_wall > 0)
+		? (double)bytes_read / 1e6 / total_wall
+		: 0;
+
+	if (json) {
+		fprintf(stream, "{\"bytes_read\":%zu,\"bytes_written\":%zu,"
+			"\"lines_scanned\":%zu,\"lines_matched\":%zu,"
+			"\"lines_aligned\":%zu,\"lines_too_long\":%zu,"
+			"\"lines_past_column\":%zu,\"padding_bytes_written\":%zu,"
+			"\"padding_bytes_removed\":%zu,\"phases\":{",
+			bytes_read, bytes_written, stats->num_lines, num_matched,
+			num_aligned, stats->num_long_lines, stats->num_past,
+			stats->pad_written, stats->pad_removed);
+
+		for (size_t i = 0; i < NUM_PHASES; i += 1) {
+			fprintf(stream, "%s\"%s\":{\"wall_s\":%.6f,\"cpu_s\":%.6f}",
+				(i > 0) ? "," : "", phase_names[i], times->wall[i],
+				times->cpu[i]);
+		}
+
+		fprintf(stream, "},\"throughput_mb_s\":%.3f,\"peak_rss_kib\":%ld}\n",
+			mb_per_s, peak_rss_kib());
+		return;
+	}
+
+	fprintf(stream,
+		"Bytes read:            %zu\n"
+		"Bytes written:         %zu\n"
+		"Lines scanned:         %zu\n"
+		"Lines matched:         %zu\n"
+		"Lines aligned:         %zu\n"
+		"Lines too long:        %zu\n"
+		"Lines past column:     %zu\n"
+		"Padding bytes written: %zu\n"
+		"Padding bytes removed: %zu\n",
+		bytes_read, bytes_written, stats->num_lines, num_matched, num_aligned,
+		stats->num_long_lines, stats->num_past, stats->pad_written,
+		stats->pad_removed);
+
+	for (size_t i = 0; i < NUM_PHASES; i += 1) {
+		fprintf(stream, "Phase %-8s wall %.6f s, cpu %.6f s\n",
+			phase_names[i], times->wall[i], times->cpu[i]);
+	}
+
+	fprintf(stream,
+		"Throughput:            %.3f MB/s\n"
+		"Peak RSS:              %ld KiB\n",
+		mb_per_s, peak_rss_kib());
+}
+
+// Print to stream how many lines each rule matched and aligned.
+void print_rule_counts(FILE *const stream,
+	const struct align_config *const config,
+	const struct align_stats *const stats)
+{
+	if (config->columns) {
+		fprintf(stream, "Columns ('%c', fill '%c'): %zu matched, "
+			"%zu aligned\n", config->columns_char, config->rules[0].fill_char,
+			stats->num_matched[0], stats->num_aligned[0]);
+		return;
+	}
+
+	for (size_t i = 0; i < config->num_rules; i += 1) {
+		const struct align_rule *const rule = &config->rules[i];
+
+		switch (rule->anchor_mode) {
+			case ANCHOR_MODE_END:
+				fprintf(stream, "Rule %zu ('%c' at ", i + 1,
+					rule->target_char);
+				break;
+			case ANCHOR_MODE_FIRST:
+				fprintf(stream, "Rule %zu (first \"%s\" at ", i + 1,
+					rule->anchor);
+				break;
+			case ANCHOR_MODE_LAST:
+				fprintf(stream, "Rule %zu (last \"%s\" at ", i + 1,
+					rule->anchor);
+				break;
+		}
+
+		if (rule->pos_mode == POSITION_MODE_BLOCK) {
+			fprintf(stream, "block+%zu", rule->pos_offset);
+		}
+		else {
+			fprintf(stream, "%zu", rule->target_pos);
+		}
+
+		fprintf(stream, ", fill '%c'): %zu matched, %zu aligned\n",
+			rule->fill_char, stats->num_matched[i], stats->num_aligned[i]);
+	}
+}
+
+// Add the widths of lines in input matched by any rule of config to census.
+// (main only allows --census with a single rule.)
+// Lines too long to align are not counted.
+// Prints to stderr and non-zero exits if file error.
+void census_stream(struct reader *const input,
+	const struct align_config *const config, struct census *const census)
+{
+	struct cpp_lexer lexer = {CPP_STATE_CODE, false, true, false, '\n'};
+	bool in_long_line = false;
+	size_t narrowest = CENSUS_WIDTHS - 1;
+	bool any_matched = false;
+
+	while (true) {
+		char buf[BUF_CAP];
+		size_t buf_len;
+		const uint8_t result = read_through_char(input, buf, BUF_CAP, '\n',
+			&buf_len);
+
+		if (result == RTC_BUF_FULL) {
+			// The rest of the line follows in the next buf(s).
+			in_long_line = true;
+
+			if (config->cpp_only) {
+				cpp_scan(&lexer, buf, buf_len);
+			}
+
+			continue;
+		}
+		else if (result != RTC_SUCCESS && result != RTC_EOF_REACHED) {
+			fprintf(stderr, "Unknown RTC error: %d\n", result);
+			exit(1);
+		}
+
+		struct line_match match = match_line(config, buf, buf_len);
+
+		if (config->cpp_only) {
+			match = cpp_filter_line(&lexer, config, buf, buf_len, match);
+		}
+
+		if (!in_long_line && match.rule_i != NO_RULE) {
+			size_t width = get_matched_width(buf, match.anchor_at,
+				&config->rules[match.rule_i], config);
+
+			if (width > CENSUS_WIDTHS - 1) {
+				width = CENSUS_WIDTHS - 1;
+			}
+
+			census->line_widths[width] += 1;
+			census->num_lines += 1;
+			any_matched = true;
+
+			if (width < narrowest) {
+				narrowest = width;
+			}
+		}
+
+		in_long_line = false;
+
+		if (result == RTC_EOF_REACHED) {
+			break;
+		}
+	}
+
+	census->num_files += 1;
+
+	if (any_matched) {
+		census->file_widths[narrowest] += 1;
+	}
+}
+
+// Open the file at path read-only and add its lines to census.
+// chunk (of capacity at least config->read_chunk) holds what is read.
+// If the file cannot be opened, print to stderr and skip it.
+void census_file(const char *const path,
+	const struct align_config *const config, char *const chunk,
+	struct census *const census)
+{
+	FILE *const file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Warning: Skipping file that failed to open: %s\n",
+			path);
+		return;
+	}
+
+	// The reader does its own buffering.
+	setvbuf(file, NULL, _IONBF, 0);
+
+	struct reader reader = {NULL, 0, 0, file, 0, SIZE_MAX,
+		chunk, config->read_chunk, 0, 0, NULL};
+	census_stream(&reader, config, census);
+
+	if (fclose(file) != 0) {
+		fprintf(stderr, "Warning: Failed to properly close file: %s\n", path);
+	}
+}
+
+// Add the counts in from into into.
+void census_merge(struct census *const into, const struct census *const from)
+{
+	for (size_t i = 0; i < CENSUS_WIDTHS; i += 1) {
+		into->line_widths[i] += from->line_widths[i];
+		into->file_widths[i] += from->file_widths[i];
+	}
+
+	into->num_files += from->num_files;
+	into->num_lines += from->num_lines;
+}
+
+// Print to stream, for each position from first through last, how many files,
+//  lines, and bytes aligning to that position would change.
+void print_census(FILE *const stream, const struct census *const census,
+	const size_t first, const size_t last)
+{
+	fprintf(stream, "Scanned %zu files, %zu matching lines\n",
+		census->num_files, census->num_lines);
+	fprintf(stream, "%8s %10s %12s %14s\n", "position", "files", "lines",
+		"bytes");
+
+	for (size_t pos = first; pos <= last; pos += 1) {
+		size_t files = 0;
+		size_t lines = 0;
+		size_t bytes = 0;
+
+		// Lines narrower than pos get pos - width fill chars.
+		for (size_t width = 0; width < pos; width += 1) {
+			files += census->file_widths[width];
+			lines += census->line_widths[width];
+			bytes += census->line_widths[width] * (pos - width);
+		}
+
+		fprintf(stream, "%8zu %10zu %12zu %14zu\n", pos, files, lines,
+			bytes);
+	}
+}
+
+#if ALIGNCHAR_POSIX
+// Add the work item with the given fields (see struct work_item) to the end
+//  of queue. Waits while queue is full.
+void path_queue_push_item(struct path_queue *const queue,
+	const char *const path, struct split_file *const split,
+	const size_t chunk_i, const size_t offset, const size_t len,
+	const size_t size)
+{
+	pthread_mutex_lock(&queue->mutex);
+
+	while (queue->count == PATH_QUEUE_CAP) {
+		pthread_cond_wait(&queue->not_full, &queue->mutex);
+	}
+
+	struct work_item *const item =
+		&queue->items[(queue->head + queue->count) % PATH_QUEUE_CAP];
+	snprintf(item->path, PATH_CAP, "%s", path);
+	item->split = split;
+	item->chunk_i = chunk_i;
+	item->offset = offset;
+	item->len = len;
+	item->size = size;
+	item->prefetched = 0;
+	queue->count += 1;
+	queue->num_pushed += 1;
+
+	pthread_cond_signal(&queue->not_empty);
+	pthread_cond_signal(&queue->changed);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+// Add path to the end of queue. Waits while queue is full.
+void path_queue_push(struct path_queue *const queue, const char *const path) {
+	path_queue_push_item(queue, path, NULL, 0, 0, SIZE_MAX, SIZE_MAX);
+}
+
+// Return the number of items waiting in queue.
+size_t path_queue_count(struct path_queue *const queue) {
+	pthread_mutex_lock(&queue->mutex);
+	const size_t count = queue->count;
+	pthread_mutex_unlock(&queue->mutex);
+
+	return count;
+}
+
+// Take the item at the front of queue into out.
+// Waits while queue is empty and not closed.
+// Return false if queue is closed and empty.
+bool path_queue_pop(struct path_queue *const queue,
+	struct work_item *const out)
+{
+	pthread_mutex_lock(&queue->mutex);
+
+	while (queue->count == 0 && !queue->closed) {
+		pthread_cond_wait(&queue->not_empty, &queue->mutex);
+	}
+
+	if (queue->count == 0) {
+		pthread_mutex_unlock(&queue->mutex);
+		return false;
+	}
+
+	*out = queue->items[queue->head];
+	queue->head = (queue->head + 1) % PATH_QUEUE_CAP;
+	queue->count -= 1;
+	queue->num_popped += 1;
+	queue->prefetched -= out->prefetched;
+
+	pthread_cond_signal(&queue->not_full);
+	pthread_cond_signal(&queue->changed);
+	pthread_mutex_unlock(&queue->mutex);
+	return true;
+}
+
+// Mark queue as getting no more paths, waking all waiting workers.
+void path_queue_close(struct path_queue *const queue) {
+	pthread_mutex_lock(&queue->mutex);
+	queue->closed = true;
+	pthread_cond_broadcast(&queue->not_empty);
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+// Push every regular file under the directory at path (of capacity
+//  PATH_CAP, modified during the walk but restored) onto queue.
+// Entries whose names start with '.' and symbolic links are skipped.
+void walk_tree(char *const path, struct path_queue *const queue) {
+	DIR *const dir = opendir(path);
+	if (dir == NULL) {
+		fprintf(stderr, "Warning: Skipping directory that failed to open: "
+			"%s\n", path);
+		return;
+	}
+
+	const size_t path_len = strlen(path);
+	const struct dirent *entry;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+
+		const int len = snprintf(path + path_len, PATH_CAP - path_len, "/%s",
+			entry->d_name);
+
+		if (len < 0 || (size_t)len >= PATH_CAP - path_len) {
+			path[path_len] = '\0';
+			fprintf(stderr, "Warning: Skipping path longer than %d in: "
+				"%s\n", PATH_CAP, path);
+			continue;
+		}
+
+		struct stat st;
+		if (lstat(path, &st) != 0) {
+			fprintf(stderr, "Warning: Skipping path that failed to stat: "
+				"%s\n", path);
+		}
+		else if (S_ISDIR(st.st_mode)) {
+			walk_tree(path, queue);
+		}
+		else if (S_ISREG(st.st_mode)) {
+			path_queue_push(queue, path);
+		}
+
+		path[path_len] = '\0';
+	}
+
+	closedir(dir);
+}
+
+// State of one census worker thread.
+struct census_worker {
+	pthread_t thread;
+	// Index for --trace, from 1.
+	size_t index;
+	const struct align_config *config;
+	struct path_queue *queue;
+	struct census census;
+	char chunk[READ_CHUNK_CAP];
+};
+
+// Census every file taken from the worker's queue until it is closed.
+void *census_worker_main(void *const arg) {
+	struct census_worker *const worker = arg;
+	struct work_item item;
+
+	while (path_queue_pop(worker->queue, &item)) {
+		const double start = wall_seconds();
+		census_file(item.path, worker->config, worker->chunk, &worker->census);
+		trace_span(worker->index, "census", item.path, start, wall_seconds());
+	}
+
+	return NULL;
+}
+#endif
+
+// Census the file at path, or every file under it if it is a directory,
+//  using num_jobs threads. Counts are added to census.
+// Directories are only supported where POSIX is available.
+void run_census(const char *const path, const struct align_config *const config,
+	const size_t num_jobs, struct census *const census)
+{
+	// Read buffer when the one file is censused on this thread.
+	static char chunk[READ_CHUNK_CAP];
+
+#if ALIGNCHAR_POSIX
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "Error: Failed to stat: %s\n", path);
+		exit(1);
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		const double start = wall_seconds();
+		census_file(path, config, chunk, census);
+		trace_span(0, "census", path, start, wall_seconds());
+		return;
+	}
+
+	static struct path_queue queue = {
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.not_empty = PTHREAD_COND_INITIALIZER,
+		.not_full = PTHREAD_COND_INITIALIZER,
+		.changed = PTHREAD_COND_INITIALIZER
+	};
+	static struct census_worker workers[MAX_JOBS];
+
+	for (size_t i = 0; i < num_jobs; i += 1) {
+		workers[i].index = i + 1;
+		workers[i].config = config;
+		workers[i].queue = &queue;
+
+		if (pthread_create(&workers[i].thread, NULL, census_worker_main,
+			&workers[i]) != 0)
+		{
+			fprintf(stderr, "Error: Failed to start worker thread\n");
+			exit(1);
+		}
+	}
+
+	static char walk_path[PATH_CAP];
+	snprintf(walk_path, PATH_CAP, "%s", path);
+	walk_tree(walk_path, &queue);
+	path_queue_close(&queue);
+
+	for (size_t i = 0; i < num_jobs; i += 1) {
+		pthread_join(workers[i].thread, NULL);
+		census_merge(census, &workers[i].census);
+	}
+#else
+	(void)num_jobs;
+	const double start = wall_seconds();
+	census_file(path, config, chunk, census);
+	trace_span(0, "census", path, start, wall_seconds());
+#endif
+}
+
+// Add the counts in from into into.
+void stats_merge(struct align_stats *const into,
+	const struct align_stats *const from)
+{
+	for (size_t i = 0; i < MAX_RULES; i += 1) {
+		into->num_matched[i] += from->num_matched[i];
+		into->num_aligned[i] += from->num_aligned[i];
+	}
+
+	into->num_lines += from->num_lines;
+	into->num_long_lines += from->num_long_lines;
+	into->num_past += from->num_past;
+	into->pad_written += from->pad_written;
+	into->pad_removed += from->pad_removed;
+}
+
+// Return the number of lines aligned by any rule of config, from stats.
+size_t count_aligned(const struct align_config *const config,
+	const struct align_stats *const stats)
+{
+	size_t num_aligned = 0;
+	for (size_t i = 0; i < config->num_rules; i += 1) {
+		num_aligned += stats->num_aligned[i];
+	}
+
+	return num_aligned;
+}
+
+// Align the chars of the file at path from offset, len of them (or to the end
+//  if SIZE_MAX), into a new file at out_path.
+// config is copied, as -p auto positions are found per file.
+// chunk (of capacity at least config->read_chunk) and spool_mem (of
+//  capacity spool_cap) are scratch space for the calling thread.
+// Counts are added to stats. Phases are traced under trace_thread.
+// Return false (after printing to stderr) if out_path was not fully written.
+bool align_file_span(const char *const path, const size_t offset,
+	const size_t len, const char *const out_path,
+	const struct align_config *const config, char *const chunk,
+	char *const spool_mem, const size_t spool_cap, const size_t trace_thread,
+	struct align_stats *const stats)
+{
+	struct phase_times times = {{0}, {0}, {{0}}, 0, 0, path, trace_thread,
+		false};
+	phase_start(&times, PHASE_OPEN);
+
+	FILE *const input = fopen(path, "rb");
+	if (input == NULL) {
+		fprintf(stderr, "Warning: Skipping file that failed to open: %s\n",
+			path);
+		return false;
+	}
+
+	// The reader does its own buffering of the input.
+	setvbuf(input, NULL, _IONBF, 0);
+
+#if ALIGNCHAR_POSIX
+	const int seek_code = fseeko(input, (off_t)offset, SEEK_SET);
+#else
+	const int seek_code = fseek(input, (long)offset, SEEK_SET);
+#endif
+	if (seek_code != 0) {
+		fprintf(stderr, "Warning: Skipping file that failed to seek: %s\n",
+			path);
+		fclose(input);
+		return false;
+	}
+
+	FILE *const output = fopen(out_path, "wb");
+	if (output == NULL) {
+		fprintf(stderr, "Warning: Skipping file as %s failed to open\n",
+			out_path);
+		fclose(input);
+		return false;
+	}
+
+	phase_stop(&times, PHASE_OPEN);
+
+	// Args: path of the file.
+	TRACEPOINT1(file_start, path);
+
+	// Counted apart from stats first, for the file_end tracepoint.
+	struct align_stats file_stats = {{0}, {0}, 0, 0, 0, 0, 0};
+	struct align_config file_config = *config;
+	struct reader reader = {NULL, 0, 0, input, 0, len,
+		chunk, config->read_chunk, 0, 0, NULL};
+	align_input(&reader, output, &file_config, spool_mem, spool_cap,
+		&file_stats, &times);
+
+	phase_start(&times, PHASE_CLOSE);
+
+	// Args: bytes written (derived as in print_stats).
+	TRACEPOINT1(write_flush,
+		reader.file_read + file_stats.pad_written - file_stats.pad_removed);
+	const int input_fclose_code = fclose(input);
+	const int output_fclose_code = fclose(output);
+
+	phase_stop(&times, PHASE_CLOSE);
+
+	// Args: path of the file, bytes read, lines aligned.
+	TRACEPOINT3(file_end, path, reader.file_read,
+		count_aligned(config, &file_stats));
+	stats_merge(stats, &file_stats);
+
+	if (input_fclose_code != 0 || output_fclose_code != 0) {
+		fprintf(stderr, "Warning: Failed to properly close %s or %s\n", path,
+			out_path);
+		return false;
+	}
+
+	return true;
+}
+
+// Write into buf (of capacity PATH_CAP) the path of the temporary file
+//  that --files-from aligns into: path plus ALIGNED_PATH_SUFFIX, then the
+//  chunk index if chunk_i is not SIZE_MAX.
+// Return false (after printing to stderr) if the path is too long.
+bool get_aligned_path(char *const buf, const char *const path,
+	const size_t chunk_i)
+{
+	const int len = (chunk_i == SIZE_MAX) ?
+		snprintf(buf, PATH_CAP, "%s%s", path, ALIGNED_PATH_SUFFIX) :
+		snprintf(buf, PATH_CAP, "%s%s%zu", path, ALIGNED_PATH_SUFFIX, chunk_i);
+
+	if (len < 0 || (size_t)len >= PATH_CAP) {
+		fprintf(stderr, "Warning: Skipping file with too long a path: %s\n",
+			path);
+		return false;
+	}
+
+	return true;
+}
+
+// Align the file at path in place (--files-from). The aligned text is written
+//  to a temporary file beside it (see get_aligned_path), which is then
+//  renamed over it. So files aligned at the same time never share a path,
+//  and the file is never left half written.
+// Arguments are as for align_file_span.
+// Return false (after printing to stderr) if the file was left unchanged.
+bool align_file_in_place(const char *const path,
+	const struct align_config *const config, char *const chunk,
+	char *const spool_mem, const size_t spool_cap, const size_t trace_thread,
+	struct align_stats *const stats)
+{
+	char aligned_path[PATH_CAP];
+	if (!get_aligned_path(aligned_path, path, SIZE_MAX)) {
+		return false;
+	}
+
+	bool replaced = align_file_span(path, 0, SIZE_MAX, aligned_path, config,
+		chunk, spool_mem, spool_cap, trace_thread, stats);
+
+	if (replaced) {
+		const double rename_start = wall_seconds();
+		replaced = rename(aligned_path, path) == 0;
+		trace_span(trace_thread, "rename", path, rename_start, wall_seconds());
+	}
+
+	if (!replaced) {
+		fprintf(stderr, "Warning: Failed to replace %s with %s. "
+			"Leaving it unchanged\n", path, aligned_path);
+		remove(aligned_path);
+		return false;
+	}
+
+	return true;
+}
+
+// Read the next path from list into path (of capacity PATH_CAP).
+// Paths end at delim ('\0' or '\n'). Empty paths are skipped, and too long
+//  paths skipped with a warning.
+// Return false at the end of list.
+// Print to stderr and non-zero exit if error.
+bool read_list_path(FILE *const list, char *const path, const int delim) {
+	size_t len = 0;
+	bool too_long = false;
+
+	while (true) {
+		const int ch = getc(list);
+
+		if (ch == EOF && ferror(list) != 0) {
+			perror("Error: Failed to read the --files-from list");
+			exit(1);
+		}
+
+		if (ch == EOF || ch == delim) {
+			path[too_long ? PATH_CAP - 1 : len] = '\0';
+
+			if (too_long) {
+				fprintf(stderr, "Warning: Skipping path of more than %d "
+					"chars starting: %s\n", PATH_CAP - 1, path);
+			}
+			else if (len > 0) {
+				return true;
+			}
+
+			if (ch == EOF) {
+				return false;
+			}
+
+			len = 0;
+			too_long = false;
+		}
+		else if (len == PATH_CAP - 1) {
+			too_long = true;
+		}
+		else {
+			path[len] = (char)ch;
+			len += 1;
+		}
+	}
+}
+
+#if ALIGNCHAR_POSIX
+// Outcomes of read_small_file and align_small_file.
+enum small_result {
+	SMALL_DONE,
+	// Left unchanged because of an error.
+	SMALL_FAILED,
+	// Left unchanged as it is not a regular file smaller than SMALL_FILE_CAP.
+	SMALL_TOO_BIG
+};
+
+// Read the file name (relative to dir_fd, as for openat) into buf (of
+//  capacity SMALL_FILE_CAP) with one read, if it is a regular file of fewer
+//  than SMALL_FILE_CAP chars, and set *len to the number of chars read.
+// Return SMALL_FAILED (without printing) if it failed to open or read.
+enum small_result read_small_file(const int dir_fd, const char *const name,
+	char *const buf, size_t *const len)
+{
+	const int fd = openat(dir_fd, name, O_RDONLY);
+	if (fd < 0) {
+		return SMALL_FAILED;
+	}
+
+	struct stat st;
+	enum small_result result = SMALL_TOO_BIG;
+
+	if (fstat(fd, &st) != 0) {
+		result = SMALL_FAILED;
+	}
+	else if (S_ISREG(st.st_mode) && st.st_size < SMALL_FILE_CAP) {
+		// One more char than the size is asked for, so that a file that grew
+		//  since fstat is noticed.
+		const ssize_t num_read = read(fd, buf, (size_t)st.st_size + 1);
+
+		// Args: bytes read.
+		TRACEPOINT1(block_read, num_read);
+
+		result = (num_read < 0) ? SMALL_FAILED :
+			((off_t)num_read > st.st_size) ? SMALL_TOO_BIG : SMALL_DONE;
+		*len = (num_read > 0) ? (size_t)num_read : 0;
+	}
+
+	close(fd);
+	return result;
+}
+
+// State of one --files-from worker thread.
+struct align_worker {
+	pthread_t thread;
+	// Index for --trace, from 1.
+	size_t index;
+	const struct align_config *config;
+	struct path_queue *queue;
+
+	struct align_stats stats;
+	// Number of files left unchanged because of an error.
+	size_t num_failed;
+
+	// The directory of the last small file, kept open so the next small
+	//  file in it is opened without resolving the directory's path again.
+	int dir_fd;
+	char dir_path[PATH_CAP];
+
+	char chunk[READ_CHUNK_CAP];
+	char spool_mem[WORKER_SPOOL_CAP];
+	char small_in[SMALL_FILE_CAP];
+	char small_out[SMALL_OUT_CAP];
+};
+
+// Make worker->dir_fd the directory holding the file at path, opening it
+//  unless it is already the one open.
+// Return the file's name within the directory, or NULL (after printing to
+//  stderr) if the directory failed to open.
+const char *enter_file_dir(struct align_worker *const worker,
+	const char *const path)
+{
+	const char *const slash = strrchr(path, '/');
+	const char *const name = (slash != NULL) ? slash + 1 : path;
+	const char *const dir = (slash != NULL) ? path : ".";
+	const size_t dir_len = (slash == NULL) ? 1 :
+		(slash == path) ? 1 : (size_t)(slash - path);
+
+	if (worker->dir_fd >= 0 && strlen(worker->dir_path) == dir_len &&
+		memcmp(worker->dir_path, dir, dir_len) == 0)
+	{
+		return name;
+	}
+
+	if (worker->dir_fd >= 0) {
+		close(worker->dir_fd);
+	}
+
+	memcpy(worker->dir_path, dir, dir_len);
+	worker->dir_path[dir_len] = '\0';
+	worker->dir_fd = open(worker->dir_path, O_RDONLY | O_DIRECTORY);
+
+	if (worker->dir_fd < 0) {
+		fprintf(stderr, "Warning: Skipping file as its directory failed to "
+			"open: %s\n", path);
+		return NULL;
+	}
+
+	return name;
+}
+
+// Align the file at path in place as align_file_in_place does, if it is
+//  small (see read_small_file). It and its temporary file are opened
+//  relative to worker->dir_fd. It is read into worker->small_in and aligned
+//  from there, and the aligned text is
+//  buffered in worker->small_out, so written with one write if it fits.
+// Prints to stderr if the file was left unchanged because of an error.
+enum small_result align_small_file(struct align_worker *const worker,
+	const char *const path)
+{
+	struct phase_times times = {{0}, {0}, {{0}}, 0, 0, path, worker->index,
+		false};
+	phase_start(&times, PHASE_OPEN);
+
+	const char *const name = enter_file_dir(worker, path);
+	if (name == NULL) {
+		return SMALL_FAILED;
+	}
+
+	size_t len = 0;
+	const enum small_result read_result = read_small_file(worker->dir_fd,
+		name, worker->small_in, &len);
+
+	if (read_result == SMALL_FAILED) {
+		fprintf(stderr, "Warning: Skipping file that failed to open or "
+			"read: %s\n", path);
+	}
+
+	if (read_result != SMALL_DONE) {
+		return read_result;
+	}
+
+	char aligned_name[PATH_CAP];
+	if (!get_aligned_path(aligned_name, name, SIZE_MAX)) {
+		return SMALL_FAILED;
+	}
+
+	const int output_fd = openat(worker->dir_fd, aligned_name,
+		O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	FILE *const output = (output_fd >= 0) ? fdopen(output_fd, "wb") : NULL;
+
+	if (output == NULL) {
+		fprintf(stderr, "Warning: Skipping file as %s%s failed to open\n",
+			path, ALIGNED_PATH_SUFFIX);
+
+		if (output_fd >= 0) {
+			close(output_fd);
+			unlinkat(worker->dir_fd, aligned_name, 0);
+		}
+
+		return SMALL_FAILED;
+	}
+
+	setvbuf(output, worker->small_out, _IOFBF, SMALL_OUT_CAP);
+
+	phase_stop(&times, PHASE_OPEN);
+
+	// Args: path of the file.
+	TRACEPOINT1(file_start, path);
+
+	// Counted apart from worker->stats first, for the file_end tracepoint.
+	struct align_stats file_stats = {{0}, {0}, 0, 0, 0, 0, 0};
+	struct align_config file_config = *worker->config;
+	struct reader reader = {worker->small_in, len, 0, NULL, 0, 0,
+		worker->chunk, worker->config->read_chunk, 0, 0, NULL};
+	align_input(&reader, output, &file_config, worker->spool_mem,
+		WORKER_SPOOL_CAP, &file_stats, &times);
+
+	phase_start(&times, PHASE_CLOSE);
+	// Args: bytes written (derived as in print_stats).
+	TRACEPOINT1(write_flush,
+		len + file_stats.pad_written - file_stats.pad_removed);
+	const bool written = fclose(output) == 0;
+	phase_stop(&times, PHASE_CLOSE);
+
+	// Args: path of the file, bytes read, lines aligned.
+	TRACEPOINT3(file_end, path, len,
+		count_aligned(worker->config, &file_stats));
+	stats_merge(&worker->stats, &file_stats);
+
+	bool replaced = written;
+
+	if (replaced) {
+		const double rename_start = wall_seconds();
+		replaced = renameat(worker->dir_fd, aligned_name, worker->dir_fd,
+			name) == 0;
+		trace_span(worker->index, "rename", path, rename_start,
+			wall_seconds());
+	}
+
+	if (!replaced) {
+		fprintf(stderr, "Warning: Failed to replace %s with %s%s. "
+			"Leaving it unchanged\n", path, path, ALIGNED_PATH_SUFFIX);
+		unlinkat(worker->dir_fd, aligned_name, 0);
+		return SMALL_FAILED;
+	}
+
+	return SMALL_DONE;
+}
+
+// Guards the fields of every struct split_file but path.
+static pthread_mutex_t split_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Record that chunk item->chunk_i of item->split was aligned (if ok) or not.
+// The worker recording the last chunk joins the chunks' files, in order,
+//  over the file, copying through buf (of capacity buf_cap), and frees the
+//  split_file. The join and rename are traced on trace_thread.
+// Return false (after printing to stderr) if this was the last chunk and
+//  the file was left unchanged.
+bool finish_chunk(const struct work_item *const item, const bool ok,
+	char *const buf, const size_t buf_cap, const size_t trace_thread)
+{
+	struct split_file *const split = item->split;
+
+	pthread_mutex_lock(&split_mutex);
+	split->num_done += 1;
+	split->failed |= !ok;
+	const bool last = split->num_done == split->num_chunks;
+	const bool failed = split->failed;
+	pthread_mutex_unlock(&split_mutex);
+
+	if (!last) {
+		return true;
+	}
+
+	const double join_start = wall_seconds();
+	char aligned_path[PATH_CAP];
+	FILE *output = NULL;
+	if (!failed && get_aligned_path(aligned_path, split->path, SIZE_MAX)) {
+		output = fopen(aligned_path, "wb");
+	}
+	bool joined = output != NULL;
+
+	for (size_t i = 0; i < split->num_chunks; i += 1) {
+		char chunk_path[PATH_CAP];
+		if (!get_aligned_path(chunk_path, split->path, i)) {
+			joined = false;
+			continue;
+		}
+
+		FILE *const input = joined ? fopen(chunk_path, "rb") : NULL;
+		if (input != NULL) {
+			size_t len;
+			while ((len = fread(buf, 1, buf_cap, input)) > 0) {
+				joined &= fwrite(buf, 1, len, output) == len;
+			}
+
+			joined &= ferror(input) == 0;
+			fclose(input);
+		}
+		else {
+			joined = false;
+		}
+
+		remove(chunk_path);
+	}
+
+	if (output != NULL) {
+		joined &= fclose(output) == 0;
+		trace_span(trace_thread, "join", split->path, join_start,
+			wall_seconds());
+
+		if (joined) {
+			const double rename_start = wall_seconds();
+			joined = rename(aligned_path, split->path) == 0;
+			trace_span(trace_thread, "rename", split->path, rename_start,
+				wall_seconds());
+		}
+
+		if (!joined) {
+			remove(aligned_path);
+		}
+	}
+
+	if (!joined) {
+		fprintf(stderr, "Warning: Failed to align %s in chunks. "
+			"Leaving it unchanged\n", split->path);
+	}
+
+	pthread_mutex_lock(&split_mutex);
+	split->in_use = false;
+	pthread_mutex_unlock(&split_mutex);
+
+	return joined;
+}
+
+// Align every file or chunk taken from the worker's queue until it is
+//  closed.
+void *align_worker_main(void *const arg) {
+	struct align_worker *const worker = arg;
+	struct work_item item;
+
+	while (path_queue_pop(worker->queue, &item)) {
+		bool ok;
+		enum small_result small = SMALL_TOO_BIG;
+
+		if (item.split == NULL &&
+			(item.size < SMALL_FILE_CAP || item.size == SIZE_MAX))
+		{
+			small = align_small_file(worker, item.path);
+		}
+
+		if (small != SMALL_TOO_BIG) {
+			ok = small == SMALL_DONE;
+		}
+		else if (item.split == NULL) {
+			ok = align_file_in_place(item.path, worker->config, worker->chunk,
+				worker->spool_mem, WORKER_SPOOL_CAP, worker->index,
+				&worker->stats);
+		}
+		else {
+			char chunk_path[PATH_CAP];
+			ok = get_aligned_path(chunk_path, item.path, item.chunk_i) &&
+				align_file_span(item.path, item.offset, item.len, chunk_path,
+					worker->config, worker->chunk, worker->spool_mem,
+					WORKER_SPOOL_CAP, worker->index, &worker->stats);
+			ok = finish_chunk(&item, ok, worker->chunk,
+				worker->config->read_chunk, worker->index);
+		}
+
+		if (!ok) {
+			worker->num_failed += 1;
+		}
+	}
+
+	return NULL;
+}
+
+// Return whether files can be aligned in independent chunks under config:
+//  not if a line's alignment depends on other lines (-p auto, -p block,
+//  --columns) or on lexer state carried across lines (--cpp-only).
+bool config_allows_split(const struct align_config *const config) {
+	if (config->columns || config->cpp_only) {
+		return false;
+	}
+
+	for (size_t i = 0; i < config->num_rules; i += 1) {
+		if (config->rules[i].pos_mode != POSITION_MODE_FIXED) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Fill starts with the offsets in the file at path (of size chars) where
+//  chunks of about split_size chars start, each just after a '\n'.
+// Return the number of chunks, or 0 if the file could not be opened.
+size_t find_chunk_starts(const char *const path, const size_t size,
+	const size_t split_size, size_t starts[MAX_SPLIT_CHUNKS])
+{
+	size_t num_chunks = size / split_size + 1;
+	if (num_chunks > MAX_SPLIT_CHUNKS) {
+		num_chunks = MAX_SPLIT_CHUNKS;
+	}
+	const size_t chunk_size = size / num_chunks + 1;
+
+	FILE *const file = fopen(path, "rb");
+	if (file == NULL) {
+		return 0;
+	}
+
+	starts[0] = 0;
+	size_t num_starts = 1;
+
+	for (size_t i = 1; i < num_chunks; i += 1) {
+		// Start from the char before, in case it is the '\n'.
+		size_t at = i * chunk_size - 1;
+		if (at < starts[num_starts - 1] ||
+			fseeko(file, (off_t)at, SEEK_SET) != 0)
+		{
+			continue;
+		}
+
+		int ch;
+		do {
+			ch = getc(file);
+			at += 1;
+		} while (ch != EOF && ch != '\n');
+
+		if (ch == EOF || at >= size) {
+			break;
+		}
+
+		starts[num_starts] = at;
+		num_starts += 1;
+	}
+
+	fclose(file);
+	return num_starts;
+}
+
+// Queue the file at path (of size chars, or SIZE_MAX if not known) on queue:
+//  whole, or, if it is over split_size chars (and split_size is not 0) and
+//  config allows, as newline-aligned chunks tracked in a free split_file of
+//  splits.
+void schedule_file(struct path_queue *const queue, const char *const path,
+	const size_t size, const struct align_config *const config,
+	const size_t split_size, struct split_file splits[SPLIT_CAP])
+{
+	size_t starts[MAX_SPLIT_CHUNKS];
+	size_t num_chunks = 0;
+
+	if (split_size > 0 && size > split_size && size != SIZE_MAX &&
+		config_allows_split(config))
+	{
+		num_chunks = find_chunk_starts(path, size, split_size, starts);
+	}
+
+	if (num_chunks < 2) {
+		path_queue_push_item(queue, path, NULL, 0, 0, SIZE_MAX, size);
+		return;
+	}
+
+	struct split_file *split = NULL;
+
+	pthread_mutex_lock(&split_mutex);
+	for (size_t i = 0; i < SPLIT_CAP && split == NULL; i += 1) {
+		if (!splits[i].in_use) {
+			split = &splits[i];
+			split->in_use = true;
+			split->num_chunks = num_chunks;
+			split->num_done = 0;
+			split->failed = false;
+		}
+	}
+	pthread_mutex_unlock(&split_mutex);
+
+	if (split == NULL) {
+		fprintf(stderr, "Error: No free split file slot. "
+			"This should NEVER happen.\n");
+		exit(1);
+	}
+
+	snprintf(split->path, PATH_CAP, "%s", path);
+
+	for (size_t i = 0; i < num_chunks; i += 1) {
+		const size_t len = (i + 1 < num_chunks) ?
+			starts[i + 1] - starts[i] : SIZE_MAX;
+		path_queue_push_item(queue, path, split, i, starts[i], len, size);
+	}
+}
+
+// State of the thread that has the files next in a queue read into the page
+//  cache ahead of the workers (--prefetch).
+struct prefetcher {
+	pthread_t thread;
+	struct path_queue *queue;
+	// Most items, counting from the next to be taken, to have read ahead.
+	size_t ahead;
+	// Most bytes to have read ahead for items still waiting.
+	size_t max_bytes;
+};
+
+// Advise the kernel to read len chars (SIZE_MAX: to the end) of the file at
+//  path from offset into the page cache, but no more than budget.
+// Return the number of bytes advised. Errors are left to the worker that
+//  aligns the file to report.
+size_t prefetch_file(const char *const path, const size_t offset,
+	const size_t len, const size_t budget)
+{
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+
+	struct stat st;
+	size_t advised = 0;
+
+	if (fstat(fd, &st) == 0 && (off_t)offset < st.st_size) {
+		advised = (size_t)st.st_size - offset;
+		advised = (len < advised) ? len : advised;
+		advised = (budget < advised) ? budget : advised;
+
+#ifdef POSIX_FADV_WILLNEED
+		posix_fadvise(fd, (off_t)offset, (off_t)advised, POSIX_FADV_WILLNEED);
+#endif
+	}
+
+	close(fd);
+	return advised;
+}
+
+// Have the items of the prefetcher's queue read ahead, in order, as far as
+//  its limits allow, until the queue is closed and every item was taken.
+void *prefetch_main(void *const arg) {
+	struct prefetcher *const prefetcher = arg;
+	struct path_queue *const queue = prefetcher->queue;
+	// Number (counting every item ever added) of the next item to read ahead.
+	size_t next = 0;
+	char path[PATH_CAP];
+
+	pthread_mutex_lock(&queue->mutex);
+
+	while (true) {
+		// Items already taken are being read by their workers.
+		if (next < queue->num_popped) {
+			next = queue->num_popped;
+		}
+
+		if (next < queue->num_pushed &&
+			next < queue->num_popped + prefetcher->ahead &&
+			queue->prefetched < prefetcher->max_bytes)
+		{
+			const struct work_item *const item = &queue->items[
+				(queue->head + next - queue->num_popped) % PATH_QUEUE_CAP];
+			snprintf(path, PATH_CAP, "%s", item->path);
+			const size_t offset = item->offset;
+			const size_t len = item->len;
+			const size_t budget = prefetcher->max_bytes - queue->prefetched;
+
+			pthread_mutex_unlock(&queue->mutex);
+			const size_t advised = prefetch_file(path, offset, len, budget);
+			pthread_mutex_lock(&queue->mutex);
+
+			// Count it only if the item is still waiting, in the same slot.
+			if (next >= queue->num_popped) {
+				queue->items[(queue->head + next - queue->num_popped) %
+					PATH_QUEUE_CAP].prefetched = advised;
+				queue->prefetched += advised;
+			}
+
+			next += 1;
+		}
+		else if (queue->closed && next >= queue->num_pushed) {
+			break;
+		}
+		else {
+			pthread_cond_wait(&queue->changed, &queue->mutex);
+		}
+	}
+
+	pthread_mutex_unlock(&queue->mutex);
+	return NULL;
+}
+#endif
+
+// Align in place every file whose path is listed in the file at list_path
+//  (or stdin if it is "-"), using num_jobs threads (--files-from).
+// Paths in the list end at delim ('\0' or '\n').
+// Files are aligned as their paths are read, before the list is complete.
+// Whenever the workers are short of work, the largest of the next
+//  SCHEDULE_WINDOW listed files is queued. Files over split_size chars
+//  (unless 0) are queued as chunks, so one huge file does not leave the
+//  other workers idle at the end.
+// With prefetch_ahead above 0, the next prefetch_ahead queued files (up to
+//  prefetch_bytes bytes of them) are read into the page cache ahead of the
+//  workers by another thread, and that many more files are kept queued.
+// Counts are added to stats.
+// Return the number of files left unchanged because of an error.
+size_t run_files_from(const char *const list_path, const int delim,
+	const struct align_config *const config, const size_t num_jobs,
+	const size_t split_size, const size_t prefetch_ahead,
+	const size_t prefetch_bytes, struct align_stats *const stats)
+{
+	const bool from_stdin = strcmp(list_path, "-") == 0;
+	FILE *const list = from_stdin ? stdin : fopen(list_path, "rb");
+
+	if (list == NULL) {
+		fprintf(stderr, "Error: Failed to open the --files-from list: %s\n",
+			list_path);
+		exit(1);
+	}
+
+	size_t num_failed = 0;
+
+#if ALIGNCHAR_POSIX
+	static struct path_queue queue = {
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.not_empty = PTHREAD_COND_INITIALIZER,
+		.not_full = PTHREAD_COND_INITIALIZER,
+		.changed = PTHREAD_COND_INITIALIZER
+	};
+	static struct align_worker workers[MAX_JOBS];
+
+	for (size_t i = 0; i < num_jobs; i += 1) {
+		workers[i].index = i + 1;
+		workers[i].config = config;
+		workers[i].queue = &queue;
+		workers[i].dir_fd = -1;
+
+		if (pthread_create(&workers[i].thread, NULL, align_worker_main,
+			&workers[i]) != 0)
+		{
+			fprintf(stderr, "Error: Failed to start worker thread\n");
+			exit(1);
+		}
+	}
+
+	static struct prefetcher prefetcher;
+	prefetcher.queue = &queue;
+	prefetcher.ahead = prefetch_ahead;
+	prefetcher.max_bytes = prefetch_bytes;
+
+	if (prefetch_ahead > 0 && pthread_create(&prefetcher.thread, NULL,
+		prefetch_main, &prefetcher) != 0)
+	{
+		fprintf(stderr, "Error: Failed to start prefetch thread\n");
+		exit(1);
+	}
+
+	static struct split_file splits[SPLIT_CAP];
+	static struct pending_file pending[SCHEDULE_WINDOW];
+	size_t num_pending = 0;
+	bool more = true;
+
+	// Sizes only matter for ordering the files between several workers and
+	//  for splitting, so otherwise the files are not statted here.
+	const bool need_sizes = num_jobs > 1 ||
+		(split_size > 0 && config_allows_split(config));
+
+	while (more || num_pending > 0) {
+		if (more) {
+			struct pending_file *const next = &pending[num_pending];
+			more = read_list_path(list, next->path, delim);
+
+			if (more) {
+				struct stat st;
+				next->size = (need_sizes && stat(next->path, &st) == 0) ?
+					(size_t)st.st_size : SIZE_MAX;
+				num_pending += 1;
+			}
+		}
+
+		// Queue the largest pending file while workers (or the prefetcher)
+		//  may run short, the window is full, or the list has ended.
+		while (num_pending > 0 && (!more || num_pending == SCHEDULE_WINDOW ||
+			path_queue_count(&queue) < num_jobs + prefetch_ahead))
+		{
+			size_t largest = 0;
+			for (size_t i = 1; i < num_pending; i += 1) {
+				if (pending[i].size > pending[largest].size) {
+					largest = i;
+				}
+			}
+
+			schedule_file(&queue, pending[largest].path, pending[largest].size,
+				config, split_size, splits);
+
+			num_pending -= 1;
+			pending[largest] = pending[num_pending];
+		}
+	}
+	path_queue_close(&queue);
+
+	for (size_t i = 0; i < num_jobs; i += 1) {
+		pthread_join(workers[i].thread, NULL);
+		stats_merge(stats, &workers[i].stats);
+		num_failed += workers[i].num_failed;
+
+		if (workers[i].dir_fd >= 0) {
+			close(workers[i].dir_fd);
+		}
+	}
+
+	if (prefetch_ahead > 0) {
+		pthread_join(prefetcher.thread, NULL);
+	}
+#else
+	(void)num_jobs;
+	(void)split_size;
+	(void)prefetch_ahead;
+	(void)prefetch_bytes;
+	static char path[PATH_CAP];
+	static char chunk[READ_CHUNK_CAP];
+	static char spool_mem[SPOOL_CAP];
+
+	while (read_list_path(list, path, delim)) {
+		if (!align_file_in_place(path, config, chunk, spool_mem, SPOOL_CAP, 0,
+			stats))
+		{
+			num_failed += 1;
+		}
+	}
+#endif
+
+	if (!from_stdin) {
+		fclose(list);
+	}
+
+	return num_failed;
+}
+
+// Return the number of worker threads to use when -j is not given:
+//  the number of online processors where known, else 1.
+size_t default_num_jobs(void) {
+#if ALIGNCHAR_POSIX
+	const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (num_cpus > MAX_JOBS) {
+		return MAX_JOBS;
+	}
+	else if (num_cpus > 0) {
+		return (size_t)num_cpus;
+	}
+#endif
+
+	return 1;
+}
+
+// Append a rule with default values to config and return it.
+// Prints to stderr and exits if there is no room for another rule.
+struct align_rule *start_rule(struct align_config *const config) {
+	if (config->num_rules == MAX_RULES) {
+		fprintf(stderr, "Error: At most %d rules may be given.\n", MAX_RULES);
+		exit(1);
+	}
+
+	struct align_rule *const rule = &config->rules[config->num_rules];
+	*rule = (struct align_rule){
+		.target_char = DEFAULT_TARGET_CHAR,
+		.target_pos = DEFAULT_TARGET_POS,
+		.fill_char = DEFAULT_FILL_CHAR
+	};
+	config->num_rules += 1;
+
+	return rule;
+}
+
+// Write the path of the tuning file into buf of capacity buf_cap:
+//  $ALIGNCHAR_TUNING if set, else TUNING_FILE_NAME in $HOME.
+// Return false if neither is set.
+bool get_tuning_path(char *const buf, const size_t buf_cap) {
+	const char *const env_path = getenv(TUNING_ENV);
+	if (env_path != NULL && env_path[0] != '\0') {
+		snprintf(buf, buf_cap, "%s", env_path);
+		return true;
+	}
+
+	const char *const home = getenv("HOME");
+	if (home == NULL || home[0] == '\0') {
+		return false;
+	}
+
+	snprintf(buf, buf_cap, "%s/%s", home, TUNING_FILE_NAME);
+	return true;
+}
+
+// Set the I/O sizes in config from the tuning file, if there is one.
+// The file holds "<key> <value>" pairs. Unknown keys and values out of range
+//  are skipped with a warning.
+void load_tuning(struct align_config *const config) {
+	char path[PATH_CAP];
+	if (!get_tuning_path(path, PATH_CAP)) {
+		return;
+	}
+
+	FILE *const file = fopen(path, "r");
+	if (file == NULL) {
+		// No tuning file. Keep the built-in defaults.
+		return;
+	}
+
+	char key[32];
+	unsigned long long value;
+	while (fscanf(file, "%31s %llu", key, &value) == 2) {
+		if (strcmp(key, "read_chunk") == 0 &&
+			value >= 1 && value <= READ_CHUNK_CAP)
+		{
+			config->read_chunk = (size_t)value;
+		}
+		else if (strcmp(key, "io_buffer") == 0 && value <= IO_BUF_CAP) {
+			config->io_buf = (size_t)value;
+		}
+		else {
+			fprintf(stderr, "Warning: Skipping \"%s %llu\" in tuning file: "
+				"%s\n", key, value, path);
+		}
+	}
+
+	fclose(file);
+}
+
+// Sizes tried by --calibrate.
+static const size_t calibrate_io_bufs[] = {0, 4096, 65536, IO_BUF_CAP};
+static const size_t calibrate_read_chunks[] = {
+	4096, 16384, DEFAULT_READ_CHUNK, READ_CHUNK_CAP
+};
+
+// Return the seconds taken by the fastest of three runs aligning with config
+//  into a temporary file, from input (read into chunk) if not NULL, else
+//  from the first text_len chars of text.
+// io_mem is the output buffer when config->io_buf is not 0.
+// Print to stderr and non-zero exit if error.
+double calibrate_run(const struct align_config *const config,
+	const char *const text, const size_t text_len, FILE *const input,
+	char *const chunk, char *const io_mem)
+{
+	double best = 0;
+
+	for (int run = 0; run < 3; run += 1) {
+		FILE *const output = tmpfile();
+		if (output == NULL) {
+			perror("Error: Failed to create temporary file");
+			exit(1);
+		}
+
+		if (config->io_buf > 0) {
+			setvbuf(output, io_mem, _IOFBF, config->io_buf);
+		}
+
+		struct reader reader = {text, text_len, 0, NULL, 0, 0,
+			NULL, 0, 0, 0, NULL};
+		if (input != NULL) {
+			rewind(input);
+			reader = (struct reader){NULL, 0, 0, input, 0, SIZE_MAX,
+				chunk, config->read_chunk, 0, 0, NULL};
+		}
+
+		struct align_stats stats = {{0}, {0}, 0, 0, 0, 0, 0};
+
+		const double start = wall_seconds();
+		align_stream(&reader, output, config, &stats);
+		const int flush_code = fflush(output);
+		const double seconds = wall_seconds() - start;
+
+		if (flush_code != 0 || fclose(output) != 0) {
+			perror("Error: Failed to write temporary file");
+			exit(1);
+		}
+
+		if (run == 0 || seconds < best) {
+			best = seconds;
+		}
+	}
+
+	return best;
+}
+
+// Time the output buffer sizes aligning generated text from memory, then
+//  the read chunk sizes reading it from a temporary file, print the
+//  throughput of each to stdout, and write the fastest to the tuning file.
+// Rules in config are used as given.
+// Return 0 if successful, 1 if the tuning file could not be written.
+int calibrate(const struct align_config *const base_config) {
+	static char text[CALIBRATE_TEXT_CAP];
+	static char chunk[READ_CHUNK_CAP];
+	static char io_mem[IO_BUF_CAP];
+
+	// Lines of varied width and indentation, half ending in the target char.
+	uint64_t rng = 88172645463325252u;
+	size_t text_len = 0;
+	while (text_len + 128 <= CALIBRATE_TEXT_CAP) {
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+
+		const size_t num_tabs = (size_t)(rng % 4);
+		const size_t width = (size_t)((rng >> 8) % 100);
+
+		memset(text + text_len, '\t', num_tabs);
+		memset(text + text_len + num_tabs, 'x', width);
+		text_len += num_tabs + width;
+
+		if ((rng >> 16) % 2 == 0) {
+			text[text_len] = base_config->rules[0].target_char;
+			text_len += 1;
+		}
+
+		text[text_len] = '\n';
+		text_len += 1;
+	}
+
+	struct align_config config = *base_config;
+	const double mb = (double)text_len / 1e6;
+
+	printf("Calibrating on %.1f MB of generated text.\n", mb);
+
+	size_t best_io_buf = DEFAULT_IO_BUF;
+	double best_seconds = 0;
+	for (size_t i = 0; i < sizeof(calibrate_io_bufs) / sizeof(size_t); i += 1)
+	{
+		config.io_buf = calibrate_io_bufs[i];
+		const double seconds = calibrate_run(&config, text, text_len, NULL,
+			chunk, io_mem);
+
+		printf("  io_buffer %7zu: %8.1f MB/s\n", config.io_buf, mb / seconds);
+
+		if (i == 0 || seconds < best_seconds) {
+			best_seconds = seconds;
+			best_io_buf = config.io_buf;
+		}
+	}
+	config.io_buf = best_io_buf;
+
+	FILE *const input = tmpfile();
+	if (input == NULL) {
+		perror("Error: Failed to create temporary file");
+		exit(1);
+	}
+	// The reader does its own buffering.
+	setvbuf(input, NULL, _IONBF, 0);
+	ensure_fwriten(input, text, text_len);
+
+	size_t best_read_chunk = DEFAULT_READ_CHUNK;
+	for (size_t i = 0;
+		i < sizeof(calibrate_read_chunks) / sizeof(size_t); i += 1)
+	{
+		config.read_chunk = calibrate_read_chunks[i];
+		const double seconds = calibrate_run(&config, NULL, 0, input,
+			chunk, io_mem);
+
+		printf("  read_chunk %6zu: %8.1f MB/s\n", config.read_chunk,
+			mb / seconds);
+
+		if (i == 0 || seconds < best_seconds) {
+			best_seconds = seconds;
+			best_read_chunk = config.read_chunk;
+		}
+	}
+
+	fclose(input);
+
+	char path[PATH_CAP];
+	if (!get_tuning_path(path, PATH_CAP)) {
+		fprintf(stderr, "Error: Set $%s or $HOME to where the tuning file "
+			"should be written.\n", TUNING_ENV);
+		return 1;
+	}
+
+	FILE *const file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Error: Failed to open tuning file: %s\n", path);
+		return 1;
+	}
+
+	fprintf(file, "read_chunk %zu\nio_buffer %zu\n", best_read_chunk,
+		best_io_buf);
+
+	if (fclose(file) != 0) {
+		fprintf(stderr, "Error: Failed to write tuning file: %s\n", path);
+		return 1;
+	}
+
+	printf("Wrote read_chunk %zu and io_buffer %zu to %s\n", best_read_chunk,
+		best_io_buf, path);
+	return 0;
+}
+
+// Print help to stdout.
+// Return 0 if successful.
+// Return 1 if error printing.
+int print_help(void) {
+	const int code = fputs(
+"alignchar: For the given input file, for each line that ends in the target\n"
+"           character (Default: '\\'), align the target character to the\n"
+"           target column position (Default: 80. First column is 1) using the\n"
+"           fill character (Default: ' '). Non-matching lines, lines of\n"
+"           length " XSTR(BUF_CAP)
+                        " and greater, and lines where the target character\n"
+"           falls on or after the target column position are unchanged.\n"
+"\n"
+"Usage examples:\n"
+"  alignchar [options] -i <input file> -o <output file>\n"
+"  alignchar [options] -i <input file> --in-place\n"
+"\n"
+"An input file must be specified (-i or --input).\n"
+"Either an output file must be specified (-o or --output)\n"
+"    or --in-place must be specified meaning modify the input file."
+"\n"
+"Options may be given in any order.\n"
+"\n"
+"Options:\n"
+"  --help               Stop parsing options, print help, exit(0)\n"
+"  --version            Stop parsing options, print version, exit(0)\n"
+"\n"
+"  -i, --input <path>   Specify input file (required)\n"
+"  -o, --output <path>  Specify output file\n"
+"                       (mutually exclusive with --in-place)\n"
+"                       Do NOT specify the same path as for input\n"
+"                       (use --in-place instead)\n"
+"  --in-place           Modify input file\n"
+"                       (mutually exclusive with -o, --output)\n"
+"  -c, --char <char>    Specify the character to be aligned (Default: '\\')\n"
+"  -p, --position <n>   Specify the column to align the character to\n"
+"                       (Default: 80)\n"
+"  -p, --position auto[+N]\n"
+"                       Align to the column of the target character on\n"
+"                       the widest matching line in the file, plus N\n"
+"                       (Default N: 0). The input is read only once\n"
+"                       and held in memory (spilling to a temporary file\n"
+"                       past 4 MiB) until it is measured.\n"
+"  -p, --position block[+N]\n"
+"                       Align each run of consecutive matching lines to\n"
+"                       the column of the target character on the widest\n"
+"                       line of that run, plus N (Default N: 0)\n"
+"  -f, --fill <char>    Specify the fill character (Default: ' ')\n"
+"  -t, --tab-width <n>  Specify tab width (Default: 4)\n"
+"  --block-cap <n>      Most bytes of a run held for -p block. Longer runs\n"
+"                       are aligned to column 80 (Default and max: "
+	XSTR(BLOCK_CAP) ")\n"
+"  --anchor-first <text>\n"
+"  --anchor-last <text>\n"
+"                       Instead of a character at the end of the line,\n"
+"                       align the first (or last) occurrence of <text>\n"
+"                       anywhere in the line. Takes the place of -c in a\n"
+"                       rule. <text> is at most 15 characters\n"
+"  --realign            Strip existing fill characters before the target\n"
+"                       character, then align. Lines already past the\n"
+"                       column keep one fill character of padding\n"
+"  --fill-tabs          Pad with as many tabs as fit (each counted as tab\n"
+"                       width columns), then fill characters. With\n"
+"                       --realign, tabs are stripped as padding too\n"
+"  --columns <char>     Instead of aligning one character per line, align\n"
+"                       every occurrence of <char> in the file into columns\n"
+"                       padded with the fill character (-f). The input is\n"
+"                       held as for -p auto. Only the first "
+	XSTR(MAX_COLUMNS) "\n"
+"                       occurrences per line are aligned\n"
+"  --cpp-only           Only align characters at the end of the line (-c)\n"
+"                       where they continue a preprocessor directive,\n"
+"                       not inside a comment or string/char literal\n"
+"  --census <first>-<last>\n"
+"                       Do not align. Instead, scan the input file (or,\n"
+"                       where supported, every file under the input\n"
+"                       directory, skipping names starting with '.') and\n"
+"                       print how many files, lines, and bytes aligning to\n"
+"                       each position from <first> through <last> would\n"
+"                       change. Needs no output file\n"
+"  --files-from <path>  Instead of -i, align in place (--in-place needed)\n"
+"                       every file listed in <path>, or stdin if <path> is\n"
+"                       -, as paths arrive. Paths end at newline, or at NUL\n"
+"                       with -0. Not combined with --census, --stats,\n"
+"                       --perf-counters, or --progress\n"
+"  -0, --null           Paths in the --files-from list end at NUL, as from\n"
+"                       find -print0 or git ls-files -z\n"
+"  --split-size <n>     With --files-from, align files over n bytes in\n"
+"                       chunks on several threads, unless a rule uses\n"
+"                       -p auto or block, --columns, or --cpp-only\n"
+"                       (0 never splits) (Default: 67108864)\n"
+"  --prefetch <n>       With --files-from, have the next n queued files read\n"
+"                       into the page cache ahead of the workers, where\n"
+"                       posix_fadvise is available (Default: 0, max "
+	XSTR(PATH_QUEUE_CAP) ")\n"
+"  --prefetch-bytes <n> Most bytes of queued files to have read ahead\n"
+"                       (Default: 67108864)\n"
+"  -j, --jobs <n>       Number of worker threads for work over many files\n"
+"                       (Default: number of processors, max "
+	XSTR(MAX_JOBS) ")\n"
+"  --stats[=json]       Print bytes, lines, padding, time per phase,\n"
+"                       throughput, and peak memory use to stderr\n"
+"  --perf-counters      Print CPU cycles, instructions, branch misses, and\n"
+"                       cache misses per phase to stderr (Linux only;\n"
+"                       skipped with a warning where not permitted)\n"
+"  --trace <path>       Write a Chrome trace-event JSON timeline of the\n"
+"                       run's phases, per file and per thread, to <path>\n"
+"  --read-chunk <n>     Read the input n bytes at a time (1 to 262144)\n"
+"                       (Default: 65536)\n"
+"  --io-buffer <n>      Buffer n bytes of output at a time (up to 1048576,\n"
+"                       0 for the C library's default) (Default: 0)\n"
+"  --calibrate          Do not align. Instead, time --read-chunk and\n"
+"                       --io-buffer sizes on generated text and write the\n"
+"                       fastest to the tuning file. Needs no input file\n"
+"  --progress           Print bytes done, MB/s, and time left to stderr\n"
+"                       twice a second\n"
+"  --rule-counts        Print lines matched and aligned per rule to stderr\n"
+"\n"
+"Multiple rules:\n"
+"  -c, -p, and -f together form a rule. Giving one of them again starts\n"
+"  a new rule, so several characters can be aligned in a single pass:\n"
+"    alignchar -c '\\' -p 80 -c ']' -p 40 -f . -i <in> -o <out>\n"
+"  Fields not given for a rule take the defaults above.\n"
+"  Each rule must target a different character.\n"
+"  At most " XSTR(MAX_RULES) " rules may be given.\n"
+"\n"
+"Tuning file:\n"
+"  Unless --read-chunk or --io-buffer is given, both are read from the\n"
+"  file $" TUNING_ENV " (Default: $HOME/" TUNING_FILE_NAME ") if it\n"
+"  exists, as written by --calibrate.\n"
+"\n"
+	, stdout);
+
+	if (code != EOF) {
+		// Printed successfully.
+		return 0;
+	}
+
+	// There was an error printing.
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]) {
+	struct align_config config = {
+		.num_rules = 0,
+		.tab_width = 4,
+		.block_cap = BLOCK_CAP,
+		.read_chunk = DEFAULT_READ_CHUNK,
+		.io_buf = DEFAULT_IO_BUF
+	};
+	start_rule(&config);
+
+	// Whether to print per-rule counts to stderr when done.
+	bool print_counts = false;
+
+	// Whether to print what the run did to stderr when done (--stats),
+	//  and whether as JSON.
+	bool print_run_stats = false;
+	bool stats_json = false;
+
+	// Whether to count hardware events per phase (--perf-counters).
+	bool use_perf_counters = false;
+
+	// Where to write a Chrome trace of the run (--trace), or NULL.
+	const char *trace_path = NULL;
+
+	// Whether to print progress to stderr while running (--progress).
+	bool show_progress = false;
+
+	// Whether --read-chunk or --io-buffer was given. If not, the tuning
+	//  file (if any) sets them.
+	bool io_sizes_given = false;
+
+	// Whether to time I/O sizes and write the tuning file instead of
+	//  aligning (--calibrate).
+	bool calibrate_mode = false;
+
+	// File listing paths to align in place (--files-from), "-" for stdin,
+	//  or NULL.
+	const char *files_from = NULL;
+
+	// Whether paths in the --files-from list end at NUL rather than newline
+	//  (-0, --null).
+	bool null_list = false;
+
+	// Listed files over this many bytes are aligned in chunks (--split-size).
+	size_t split_size = DEFAULT_SPLIT_SIZE;
+
+	// Listed files to read ahead of the workers (--prefetch), and the most
+	//  bytes of them (--prefetch-bytes).
+	size_t prefetch_ahead = 0;
+	size_t prefetch_bytes = DEFAULT_PREFETCH_BYTES;
+
+	// Whether to only report what positions first through last would change
+	//  (--census) instead of aligning.
+	bool census_mode = false;
+	size_t census_first = 0;
+	size_t census_last = 0;
+
+	// Number of worker threads for work over many files.
+	size_t num_jobs = default_num_jobs();
+
+	struct maybe_char_ptr maybe_input_path = {false};
+
+	const char *output_path = NULL;
+	enum output_mode output_mode = OUTPUT_MODE_UNSET;
+
+	// Parse command line arguments.
+	for (int i = 1; i < argc; i += 1) {
+		if (strcmp(argv[i], "--help") == 0) {
+			exit(print_help());
+		}
+		else if (strcmp(argv[i], "--version") == 0) {
+			const int code = fputs(VERSION_STR, stdout);
+
+			if (code != EOF) {
+				exit(0);
+			}
+			else {
+				exit(1);
+			}
+		}
+		else if (
+			(strcmp(argv[i], "-i")      == 0) ||
+			(strcmp(argv[i], "--input") == 0)
+		) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: The path to the input file must be "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			if (maybe_input_path.exists) {
+				fprintf(stderr, "Error: Only specify input file once. "
+					"Current input file path: %s", maybe_input_path.value);
+				exit(1);
+			}
+
+			maybe_input_path = (struct maybe_char_ptr){true, argv[i + 1]};
+
+			// Jump over the input path.
 			i += 1;
 		}
 		else if (
@@ -348,167 +3982,583 @@ int main(int argc, char *argv[]) {
 			}
 
 			if (i == (argc - 1)) {
-				fprintf(stderr, "Error: The path to the output file must be "
+				fprintf(stderr, "Error: The path to the output file must be "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			output_path = argv[i + 1];
+			output_mode = OUTPUT_MODE_OUTPUT;
+
+			// Jump over output path.
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--in-place") == 0) {
+			switch(output_mode) {
+				case OUTPUT_MODE_UNSET: break; // Expected.
+				case OUTPUT_MODE_OUTPUT:
+				{
+					fprintf(stderr, "Error: Do not specify both --in-place and "
+						"output file (-o or --output). Instead, specify "
+						"exactly one of them.\n");
+					exit(1);
+				}
+				case OUTPUT_MODE_IN_PLACE:
+				{
+					fprintf(stderr, "Error: Do not specify --in-place more "
+						"than once.\n");
+					exit(1);
+				}
+				default:
+				{
+					fprintf(stderr, "Error: Unknown output_mode value (when "
+						"handling option --in-place): %d. "
+						"This should NEVER happen.\n", output_mode);
+					exit(1);
+				}
+			}
+
+			output_mode = OUTPUT_MODE_IN_PLACE;
+		}
+		else if (
+			(strcmp(argv[i], "-c")     == 0) ||
+			(strcmp(argv[i], "--char") == 0)
+		) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify target char "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			const char *const char_str = argv[i + 1];
+
+			if (strlen(char_str) != 1) {
+				fprintf(stderr, "Error: Pass exactly one character to %s\n",
+					argv[i]);
+				exit(1);
+			}
+
+			struct align_rule *rule = &config.rules[config.num_rules - 1];
+			if (rule->has_char) {
+				rule = start_rule(&config);
+			}
+
+			rule->target_char = char_str[0];
+			rule->has_char = true;
+
+			// Jump over target char.
+			i += 1;
+		}
+		else if (
+			(strcmp(argv[i], "--anchor-first") == 0) ||
+			(strcmp(argv[i], "--anchor-last")  == 0)
+		) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify anchor text "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			const char *const anchor_str = argv[i + 1];
+			const size_t anchor_len = strlen(anchor_str);
+
+			if (anchor_len == 0 || anchor_len >= ANCHOR_CAP ||
+				strchr(anchor_str, '\n') != NULL)
+			{
+				fprintf(stderr, "Error: Pass 1 to %d characters (no newlines) "
+					"to %s\n", ANCHOR_CAP - 1, argv[i]);
+				exit(1);
+			}
+
+			// An anchor takes the place of the rule's -c.
+			struct align_rule *rule = &config.rules[config.num_rules - 1];
+			if (rule->has_char) {
+				rule = start_rule(&config);
+			}
+
+			rule->anchor_mode = (strcmp(argv[i], "--anchor-first") == 0)
+				? ANCHOR_MODE_FIRST
+				: ANCHOR_MODE_LAST;
+			memcpy(rule->anchor, anchor_str, anchor_len + 1);
+			rule->anchor_len = anchor_len;
+			rule->has_char = true;
+
+			// Jump over anchor text.
+			i += 1;
+		}
+		else if (
+			(strcmp(argv[i], "-p")         == 0) ||
+			(strcmp(argv[i], "--position") == 0)
+		) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify target column "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			const char *const pos_str = argv[i + 1];
+
+			// "auto[+N]" and "block[+N]" measure the column from the input.
+			enum position_mode pos_mode = POSITION_MODE_FIXED;
+			const char *num_str = pos_str;
+
+			if (strncmp(pos_str, "auto", 4) == 0) {
+				pos_mode = POSITION_MODE_AUTO;
+				num_str = pos_str + 4;
+			}
+			else if (strncmp(pos_str, "block", 5) == 0) {
+				pos_mode = POSITION_MODE_BLOCK;
+				num_str = pos_str + 5;
+			}
+
+			long long val = 0;
+
+			if (pos_mode == POSITION_MODE_FIXED || num_str[0] != '\0') {
+				if (pos_mode != POSITION_MODE_FIXED) {
+					if (num_str[0] != '+') {
+						fprintf(stderr, "Error: Expected \"+N\" after the "
+							"mode in column position \"%s\"\n", pos_str);
+						exit(1);
+					}
+
+					num_str += 1;
+				}
+
+				errno = 0;
+				val = strtoll(num_str, NULL, 10);
+
+				if (errno != 0) {
+					fprintf(stderr, "Error: Failed to parse column position "
+						"from \"%s\" as long long.\n", pos_str);
+					exit(1);
+				}
+			}
+
+			if (pos_mode == POSITION_MODE_FIXED) {
+				if (val <= 0 || val >= BUF_CAP) {
+					fprintf(stderr, "Error: Column position must be between "
+						"0 and %d\n", BUF_CAP);
+					exit(1);
+				}
+			}
+			else if (val < 0 || val >= BUF_CAP) {
+				fprintf(stderr, "Error: Column offset N in \"%s\" must be "
+					"at least 0 and less than %d\n", pos_str, BUF_CAP);
+				exit(1);
+			}
+
+			struct align_rule *rule = &config.rules[config.num_rules - 1];
+			if (rule->has_pos) {
+				rule = start_rule(&config);
+			}
+
+			rule->pos_mode = pos_mode;
+			if (pos_mode == POSITION_MODE_FIXED) {
+				rule->target_pos = (size_t)val;
+			}
+			else {
+				rule->pos_offset = (size_t)val;
+			}
+			rule->has_pos = true;
+
+			// Jump over position.
+			i += 1;
+		}
+		else if (
+			(strcmp(argv[i], "-f")     == 0) ||
+			(strcmp(argv[i], "--fill") == 0)
+		) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify fill char "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			const char *const char_str = argv[i + 1];
+
+			if (strlen(char_str) != 1) {
+				fprintf(stderr, "Error: Pass exactly one character to %s\n",
+					argv[i]);
+				exit(1);
+			}
+
+			struct align_rule *rule = &config.rules[config.num_rules - 1];
+			if (rule->has_fill) {
+				rule = start_rule(&config);
+			}
+
+			rule->fill_char = char_str[0];
+			rule->has_fill = true;
+
+			// Jump over fill char.
+			i += 1;
+		}
+		else if (
+			(strcmp(argv[i], "-t")          == 0) ||
+			(strcmp(argv[i], "--tab-width") == 0)
+		) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify tab width "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			const char *const width_str = argv[i + 1];
+
+			errno = 0;
+			const long long val = strtoll(width_str, NULL, 10);
+
+			if (errno != 0) {
+				fprintf(stderr, "Error: Failed to parse tab width from "
+					"\"%s\" as long long.\n", width_str);
+				exit(1);
+			}
+
+			if (val < 0) {
+				fprintf(stderr, "Error: Given tab width (%lld) must not be "
+					"negative.\n", val);
+				exit(1);
+			}
+
+			// If long long type larger than size_t,
+			//  check that the parsed val does not overflow size_t.
+			// long long is signed and size_t is unsigned,
+			//  so we know conversion is safe otherwise.
+			if (sizeof(long long) > sizeof(size_t)) {
+				if (val > ((long long)SIZE_MAX)) {
+					fprintf(stderr, "Error: Given tab width (%lld) overflows "
+						"SIZE_MAX (%zu). Specify a smaller tab width.\n",
+						val, SIZE_MAX);
+					exit(1);
+				}
+			}
+
+			config.tab_width = (size_t)val;
+
+			// Jump over tab width.
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--block-cap") == 0) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify block capacity "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			const char *const cap_str = argv[i + 1];
+
+			errno = 0;
+			const long long val = strtoll(cap_str, NULL, 10);
+
+			if (errno != 0) {
+				fprintf(stderr, "Error: Failed to parse block capacity from "
+					"\"%s\" as long long.\n", cap_str);
+				exit(1);
+			}
+
+			if (val <= 0 || val > BLOCK_CAP) {
+				fprintf(stderr, "Error: Block capacity must be between "
+					"1 and %d\n", BLOCK_CAP);
+				exit(1);
+			}
+
+			config.block_cap = (size_t)val;
+
+			// Jump over block capacity.
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--realign") == 0) {
+			config.realign = true;
+		}
+		else if (strcmp(argv[i], "--fill-tabs") == 0) {
+			config.fill_tabs = true;
+		}
+		else if (strcmp(argv[i], "--columns") == 0) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify column delimiter char "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			const char *const char_str = argv[i + 1];
+
+			if (strlen(char_str) != 1 || char_str[0] == '\n') {
+				fprintf(stderr, "Error: Pass exactly one character (not a "
+					"newline) to %s\n", argv[i]);
+				exit(1);
+			}
+
+			config.columns = true;
+			config.columns_char = char_str[0];
+
+			// Jump over delimiter char.
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--cpp-only") == 0) {
+			config.cpp_only = true;
+		}
+		else if (strcmp(argv[i], "--census") == 0) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify position range "
+					"after %s\n", argv[i]);
+				exit(1);
+			}
+
+			const char *const range_str = argv[i + 1];
+			char *end;
+
+			errno = 0;
+			const long long first = strtoll(range_str, &end, 10);
+			const long long last =
+				(end[0] == '-') ? strtoll(end + 1, NULL, 10) : -1;
+
+			if (errno != 0 || end[0] != '-') {
+				fprintf(stderr, "Error: Failed to parse position range from "
+					"\"%s\" as <first>-<last>.\n", range_str);
+				exit(1);
+			}
+
+			if (first <= 0 || last < first || last >= BUF_CAP) {
+				fprintf(stderr, "Error: Census positions must be between "
+					"0 and %d, first no greater than last\n", BUF_CAP);
+				exit(1);
+			}
+
+			census_mode = true;
+			census_first = (size_t)first;
+			census_last = (size_t)last;
+
+			// Jump over position range.
+			i += 1;
+		}
+		else if (
+			(strcmp(argv[i], "-j")     == 0) ||
+			(strcmp(argv[i], "--jobs") == 0)
+		) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: Must specify number of jobs "
 					"after %s\n", argv[i]);
 				exit(1);
 			}
 
-			output_path = argv[i + 1];
-			output_mode = OUTPUT_MODE_OUTPUT;
+			const char *const jobs_str = argv[i + 1];
 
-			// Jump over output path.
+			errno = 0;
+			const long long val = strtoll(jobs_str, NULL, 10);
+
+			if (errno != 0) {
+				fprintf(stderr, "Error: Failed to parse number of jobs from "
+					"\"%s\" as long long.\n", jobs_str);
+				exit(1);
+			}
+
+			if (val <= 0 || val > MAX_JOBS) {
+				fprintf(stderr, "Error: Number of jobs must be between "
+					"1 and %d\n", MAX_JOBS);
+				exit(1);
+			}
+
+			num_jobs = (size_t)val;
+
+			// Jump over number of jobs.
 			i += 1;
 		}
-		else if (strcmp(argv[i], "--in-place") == 0) {
-			switch(output_mode) {
-				case OUTPUT_MODE_UNSET: break; // Expected.
-				case OUTPUT_MODE_OUTPUT:
-				{
-					fprintf(stderr, "Error: Do not specify both --in-place and "
-						"output file (-o or --output). Instead, specify "
-						"exactly one of them.\n");
-					exit(1);
-				}
-				case OUTPUT_MODE_IN_PLACE:
-				{
-					fprintf(stderr, "Error: Do not specify --in-place more "
-						"than once.\n");
-					exit(1);
-				}
-				default:
-				{
-					fprintf(stderr, "Error: Unknown output_mode value (when "
-						"handling option --in-place): %d. "
-						"This should NEVER happen.\n", output_mode);
-					exit(1);
-				}
+		else if (strcmp(argv[i], "--stats") == 0) {
+			print_run_stats = true;
+		}
+		else if (strcmp(argv[i], "--stats=json") == 0) {
+			print_run_stats = true;
+			stats_json = true;
+		}
+		else if (strcmp(argv[i], "--trace") == 0) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: The path to the trace file must be "
+					"after %s\n", argv[i]);
+				exit(1);
 			}
 
-			output_mode = OUTPUT_MODE_IN_PLACE;
+			trace_path = argv[i + 1];
+			trace_enabled = true;
+			trace_epoch = wall_seconds();
+
+			// Jump over trace path.
+			i += 1;
 		}
 		else if (
-			(strcmp(argv[i], "-c")     == 0) ||
-			(strcmp(argv[i], "--char") == 0)
+			(strcmp(argv[i], "--read-chunk") == 0) ||
+			(strcmp(argv[i], "--io-buffer")  == 0)
 		) {
+			const bool is_chunk = strcmp(argv[i], "--read-chunk") == 0;
+			const long long min = is_chunk ? 1 : 0;
+			const long long max = is_chunk ? READ_CHUNK_CAP : IO_BUF_CAP;
+
 			if (i == (argc - 1)) {
-				fprintf(stderr, "Error: Must specify target char "
+				fprintf(stderr, "Error: Must specify a size in bytes "
 					"after %s\n", argv[i]);
 				exit(1);
 			}
 
-			const char *const char_str = argv[i + 1];
+			const char *const size_str = argv[i + 1];
 
-			if (strlen(char_str) != 1) {
-				fprintf(stderr, "Error: Pass exactly one character to %s\n",
-					argv[i]);
+			errno = 0;
+			const long long val = strtoll(size_str, NULL, 10);
+
+			if (errno != 0) {
+				fprintf(stderr, "Error: Failed to parse size from "
+					"\"%s\" as long long.\n", size_str);
+				exit(1);
+			}
+
+			if (val < min || val > max) {
+				fprintf(stderr, "Error: %s must be between %lld and %lld\n",
+					argv[i], min, max);
 				exit(1);
 			}
 
-			target_char = char_str[0];
+			if (is_chunk) {
+				config.read_chunk = (size_t)val;
+			}
+			else {
+				config.io_buf = (size_t)val;
+			}
+			io_sizes_given = true;
 
-			// Jump over target char.
+			// Jump over size.
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--files-from") == 0) {
+			if (i == (argc - 1)) {
+				fprintf(stderr, "Error: The path to the file list (or -) must "
+					"be after %s\n", argv[i]);
+				exit(1);
+			}
+
+			files_from = argv[i + 1];
+
+			// Jump over list path.
 			i += 1;
 		}
 		else if (
-			(strcmp(argv[i], "-p")         == 0) ||
-			(strcmp(argv[i], "--position") == 0)
+			(strcmp(argv[i], "-0") == 0) ||
+			(strcmp(argv[i], "--null") == 0)
 		) {
+			null_list = true;
+		}
+		else if (strcmp(argv[i], "--split-size") == 0) {
 			if (i == (argc - 1)) {
-				fprintf(stderr, "Error: Must specify target column "
+				fprintf(stderr, "Error: Must specify a size in bytes "
 					"after %s\n", argv[i]);
 				exit(1);
 			}
 
-			const char *const pos_str = argv[i + 1];
+			const char *const size_str = argv[i + 1];
 
 			errno = 0;
-			const long long val = strtoll(pos_str, NULL, 10);
+			const long long val = strtoll(size_str, NULL, 10);
 
 			if (errno != 0) {
-				fprintf(stderr, "Error: Failed to parse column position from "
-					"\"%s\" as long long.\n", pos_str);
+				fprintf(stderr, "Error: Failed to parse split size from "
+					"\"%s\" as long long.\n", size_str);
 				exit(1);
 			}
 
-			if (val <= 0 || val >= BUF_CAP) {
-				fprintf(stderr, "Error: Column position must be between "
-					"0 and %d\n", BUF_CAP);
+			if (val < 0) {
+				fprintf(stderr, "Error: Given split size (%lld) must not be "
+					"negative.\n", val);
 				exit(1);
 			}
 
-			target_pos = (size_t)val;
+			if (sizeof(long long) > sizeof(size_t)) {
+				if (val > ((long long)SIZE_MAX)) {
+					fprintf(stderr, "Error: Given split size (%lld) overflows "
+						"SIZE_MAX (%zu).\n", val, SIZE_MAX);
+					exit(1);
+				}
+			}
+
+			split_size = (size_t)val;
 
-			// Jump over position.
+			// Jump over split size.
 			i += 1;
 		}
-		else if (
-			(strcmp(argv[i], "-f")     == 0) ||
-			(strcmp(argv[i], "--fill") == 0)
-		) {
+		else if (strcmp(argv[i], "--prefetch") == 0) {
 			if (i == (argc - 1)) {
-				fprintf(stderr, "Error: Must specify fill char "
+				fprintf(stderr, "Error: Must specify number of files "
 					"after %s\n", argv[i]);
 				exit(1);
 			}
 
-			const char *const char_str = argv[i + 1];
+			const char *const ahead_str = argv[i + 1];
 
-			if (strlen(char_str) != 1) {
-				fprintf(stderr, "Error: Pass exactly one character to %s\n",
-					argv[i]);
+			errno = 0;
+			const long long val = strtoll(ahead_str, NULL, 10);
+
+			if (errno != 0) {
+				fprintf(stderr, "Error: Failed to parse number of files from "
+					"\"%s\" as long long.\n", ahead_str);
+				exit(1);
+			}
+
+			if (val < 0 || val > PATH_QUEUE_CAP) {
+				fprintf(stderr, "Error: Number of files to prefetch must be "
+					"between 0 and %d\n", PATH_QUEUE_CAP);
 				exit(1);
 			}
 
-			fill_char = char_str[0];
+			prefetch_ahead = (size_t)val;
 
-			// Jump over fill char.
+			// Jump over number of files.
 			i += 1;
 		}
-		else if (
-			(strcmp(argv[i], "-t")          == 0) ||
-			(strcmp(argv[i], "--tab-width") == 0)
-		) {
+		else if (strcmp(argv[i], "--prefetch-bytes") == 0) {
 			if (i == (argc - 1)) {
-				fprintf(stderr, "Error: Must specify tab width "
+				fprintf(stderr, "Error: Must specify a size in bytes "
 					"after %s\n", argv[i]);
 				exit(1);
 			}
 
-			const char *const width_str = argv[i + 1];
+			const char *const size_str = argv[i + 1];
 
 			errno = 0;
-			const long long val = strtoll(width_str, NULL, 10);
+			const long long val = strtoll(size_str, NULL, 10);
 
 			if (errno != 0) {
-				fprintf(stderr, "Error: Failed to parse tab width from "
-					"\"%s\" as long long.\n", width_str);
+				fprintf(stderr, "Error: Failed to parse prefetch size from "
+					"\"%s\" as long long.\n", size_str);
 				exit(1);
 			}
 
-			if (val < 0) {
-				fprintf(stderr, "Error: Given tab width (%lld) must not be "
-					"negative.\n", val);
+			if (val <= 0) {
+				fprintf(stderr, "Error: Given prefetch size (%lld) must be "
+					"positive.\n", val);
 				exit(1);
 			}
 
-			// If long long type larger than size_t,
-			//  check that the parsed val does not overflow size_t.
-			// long long is signed and size_t is unsigned,
-			//  so we know conversion is safe otherwise.
 			if (sizeof(long long) > sizeof(size_t)) {
 				if (val > ((long long)SIZE_MAX)) {
-					fprintf(stderr, "Error: Given tab width (%lld) overflows "
-						"SIZE_MAX (%zu). Specify a smaller tab width.\n",
-						val, SIZE_MAX);
+					fprintf(stderr, "Error: Given prefetch size (%lld) "
+						"overflows SIZE_MAX (%zu).\n", val, SIZE_MAX);
 					exit(1);
 				}
 			}
 
-			tab_width = (size_t)val;
+			prefetch_bytes = (size_t)val;
 
-			// Jump over tab width.
+			// Jump over prefetch size.
 			i += 1;
 		}
+		else if (strcmp(argv[i], "--calibrate") == 0) {
+			calibrate_mode = true;
+		}
+		else if (strcmp(argv[i], "--progress") == 0) {
+			show_progress = true;
+		}
+		else if (strcmp(argv[i], "--perf-counters") == 0) {
+			use_perf_counters = true;
+		}
+		else if (strcmp(argv[i], "--rule-counts") == 0) {
+			print_counts = true;
+		}
 		else {
 			fprintf(stderr, "Error: Unrecognized arg: %s\n", argv[i]);
 			exit(1);
@@ -517,7 +4567,22 @@ int main(int argc, char *argv[]) {
 
 	// Perform some final validation of inputs.
 
-	if (!maybe_input_path.exists) {
+	if (files_from != NULL) {
+		if (maybe_input_path.exists || output_mode != OUTPUT_MODE_IN_PLACE) {
+			fprintf(stderr, "Error: --files-from takes the place of -i and "
+				"needs --in-place.\n");
+			exit(1);
+		}
+
+		if (census_mode || print_run_stats || use_perf_counters ||
+			show_progress)
+		{
+			fprintf(stderr, "Error: Do not combine --files-from with "
+				"--census, --stats, --perf-counters, or --progress.\n");
+			exit(1);
+		}
+	}
+	else if (!maybe_input_path.exists && !calibrate_mode) {
 		fprintf(stderr, "Error: You need to specify the input file using "
 			"-i or --input option.\n");
 		exit(1);
@@ -525,6 +4590,82 @@ int main(int argc, char *argv[]) {
 
 	const char *input_path = maybe_input_path.value;
 
+	if (config.columns && (config.num_rules > 1 ||
+		config.rules[0].has_char || config.rules[0].has_pos))
+	{
+		fprintf(stderr, "Error: Do not combine --columns with -c or -p. "
+			"Only -f applies to --columns.\n");
+		exit(1);
+	}
+
+	// Build the lookup table from char before '\n' to rule.
+	memset(config.rule_index, NO_RULE, sizeof(config.rule_index));
+	for (size_t i = 0; i < config.num_rules; i += 1) {
+		if (config.rules[i].anchor_mode != ANCHOR_MODE_END) {
+			config.mid_rules[config.num_mid_rules] = (uint8_t)i;
+			config.num_mid_rules += 1;
+			continue;
+		}
+
+		const unsigned char target =
+			(unsigned char)config.rules[i].target_char;
+
+		if (config.rule_index[target] != NO_RULE) {
+			fprintf(stderr, "Error: Rules %d and %zu both target the "
+				"character '%c'. Give each rule a different -c.\n",
+				config.rule_index[target] + 1, i + 1, (char)target);
+			exit(1);
+		}
+
+		config.rule_index[target] = (uint8_t)i;
+	}
+
+	if (calibrate_mode) {
+		return calibrate(&config);
+	}
+
+	if (!io_sizes_given) {
+		load_tuning(&config);
+	}
+
+	if (files_from != NULL) {
+		struct align_stats stats = {{0}, {0}, 0, 0, 0, 0, 0};
+		const size_t num_failed = run_files_from(files_from,
+			null_list ? '\0' : '\n', &config, num_jobs, split_size,
+			prefetch_ahead, prefetch_bytes, &stats);
+
+		if (print_counts) {
+			print_rule_counts(stderr, &config, &stats);
+		}
+
+		if (trace_path != NULL && !write_trace(trace_path)) {
+			return 1;
+		}
+
+		return (num_failed == 0) ? 0 : 1;
+	}
+
+	if (census_mode) {
+		if (config.num_rules > 1 || config.rules[0].has_pos ||
+			config.columns || config.realign || config.fill_tabs)
+		{
+			fprintf(stderr, "Error: --census reports on a single rule "
+				"without -p. Do not combine it with -p, --columns, "
+				"--realign, or --fill-tabs.\n");
+			exit(1);
+		}
+
+		static struct census census;
+		run_census(input_path, &config, num_jobs, &census);
+		print_census(stdout, &census, census_first, census_last);
+
+		if (trace_path != NULL && !write_trace(trace_path)) {
+			return 1;
+		}
+
+		return 0;
+	}
+
 	switch (output_mode) {
 		case OUTPUT_MODE_UNSET:
 		{
@@ -546,138 +4687,192 @@ int main(int argc, char *argv[]) {
 
 	// Open the input and output files.
 
-	if (output_mode == OUTPUT_MODE_IN_PLACE) {
-		// We are not going to modify the input file in place.
-		// We are going to output to its path.
-		// We need to move it/make a copy first.
+	if (use_perf_counters && perf_counters_open() == 0) {
+		fprintf(stderr, "Warning: Perf counters not available (%s). "
+			"Continuing without them.\n", strerror(errno));
+		use_perf_counters = false;
+	}
+
+	struct phase_times times = {{0}, {0}, {{0}}, 0, 0, input_path, 0,
+		false};
+	phase_start(&times, PHASE_OPEN);
+
+	// A small input file is read whole here, as --files-from reads one, and
+	//  aligned from memory.
+	static char small_mem[SMALL_FILE_CAP];
+	size_t small_len = 0;
+#if ALIGNCHAR_POSIX
+	const bool small = !show_progress && read_small_file(AT_FDCWD,
+		input_path, small_mem, &small_len) == SMALL_DONE;
+#else
+	const bool small = false;
+#endif
+
+	// For --in-place, the output is written to a temporary file beside the
+	//  input (see get_aligned_path), which is renamed over it only once
+	//  fully written, whatever the input's size.
+	char aligned_path[PATH_CAP] = "";
+	const char *write_path = output_path;
 
-		const int rename_code = rename(input_path, INPUT_PATH_RENAMED);
+	if (output_mode == OUTPUT_MODE_IN_PLACE) {
+		const int len = snprintf(aligned_path, PATH_CAP, "%s%s", input_path,
+			ALIGNED_PATH_SUFFIX);
 
-		if (rename_code != 0) {
-			fprintf(stderr, "Error: Failed to move input file at: \"%s\" to "
-				"the backup file path: \"%s\"\n",
-				input_path, INPUT_PATH_RENAMED);
+		if (len < 0 || (size_t)len >= PATH_CAP) {
+			fprintf(stderr, "Error: Input path too long: %s\n", input_path);
 			exit(1);
 		}
 
 		output_path = input_path;
-		input_path = INPUT_PATH_RENAMED;
+		write_path = aligned_path;
 	}
 
-	FILE *const input = fopen(input_path, "rb");
-	if (input == NULL) {
+	// Args: path of the file.
+	TRACEPOINT1(file_start, times.path);
+
+	FILE *const input = small ? NULL : fopen(input_path, "rb");
+	if (!small && input == NULL) {
 		fprintf(stderr, "Error: Failed to open input file: %s\n",
 			input_path);
 		exit(1);
 	}
 
-	FILE *const output = fopen(output_path, "wb");
+	FILE *const output = fopen(write_path, "wb");
 	if (output == NULL) {
 		fprintf(stderr, "Error: Failed to open output file: %s\n",
-			output_path);
+			write_path);
 		exit(1);
 	}
 
-	// Begin reading input and outputting.
+	if (small) {
+		static char small_out[SMALL_OUT_CAP];
+		setvbuf(output, small_out, _IOFBF, SMALL_OUT_CAP);
+	}
+	else if (config.io_buf > 0) {
+		static char output_buf[IO_BUF_CAP];
+		setvbuf(output, output_buf, _IOFBF, config.io_buf);
+	}
 
-	while (true) {
-		char buf[BUF_CAP];
-		size_t buf_len;
-		const uint8_t result = read_through_char(input, buf, BUF_CAP, '\n',
-			&buf_len);
+	if (input != NULL) {
+		// The reader does its own buffering of the input.
+		setvbuf(input, NULL, _IONBF, 0);
+	}
 
-		if (result == RTC_SUCCESS || result == RTC_EOF_REACHED) {
-			if (buf_len == 1) {
-				// Blank line (only '\n').
-				// We still need to write it out though.
-				ensure_fwriten(output, buf, buf_len);
+	phase_stop(&times, PHASE_OPEN);
 
-				if (result == RTC_EOF_REACHED) {
-					// All lines handled.
-					break;
-				}
+#if ALIGNCHAR_POSIX
+	static struct progress_reporter progress;
 
-				continue;
-			}
+	if (show_progress) {
+		// Size is only known for regular files.
+		struct stat st;
+		const size_t total = (fstat(fileno(input), &st) == 0 &&
+			S_ISREG(st.st_mode)) ? (size_t)st.st_size : 0;
 
-			// If the last char before the '\n' is target_char
-			if (buf[buf_len - 2] == target_char) {
-				size_t line_width = get_line_width(buf, tab_width);
+		show_progress = progress_start(&progress, total);
+		times.show_progress = show_progress;
+	}
+#else
+	if (show_progress) {
+		fprintf(stderr, "Warning: --progress is not supported on this "
+			"platform.\n");
+		show_progress = false;
+	}
+#endif
 
-				if (line_width >= target_pos) {
-					// Nothing for us to do except write out line.
-					ensure_fwriten(output, buf, buf_len);
-				}
-				else {
-					// Align the target_char to target_pos position.
-
-					// Write out line except for target_char and '\n'
-					ensure_fwriten(output, buf, buf_len - 2);
-
-					// (line_width - 1) because we should not count the
-					//  target_char that we did not print above.
-					// Assume: target_pos >= 1
-					for (size_t i = line_width - 1; i < target_pos - 1;
-					     i += 1)
-					{
-						checked_fputc(fill_char, output);
-					}
+	// Begin reading input and outputting.
 
-					checked_fputc(target_char, output);
-					checked_fputc('\n', output);
-				}
-			}
-			else {
-				// Simply write line out.
-				ensure_fwriten(output, buf, buf_len);
-			}
+	struct align_stats stats = {{0}, {0}, 0, 0, 0, 0, 0};
+	static char read_chunk[READ_CHUNK_CAP];
+	struct reader reader = {small_mem, small_len, 0, input, 0,
+		SIZE_MAX, read_chunk, config.read_chunk, 0, 0,
+		show_progress ? &progress_done : NULL};
 
-			if (result == RTC_EOF_REACHED) {
-				// All lines handled.
-				break;
-			}
-		}
-		else if (result == RTC_BUF_FULL) {
-			// Line is too long.
-			// We just write it out and walk past the rest of it.
-			ensure_fwriten(output, buf, buf_len);
+	static char spool_mem[SPOOL_CAP];
+	align_input(&reader, output, &config, spool_mem, SPOOL_CAP, &stats,
+		&times);
 
-			if (!transfer_through_char(input, output, '\n')) {
-				// EOF reached. All done.
-				break;
-			}
-		}
-		else {
-			fprintf(stderr, "Unknown RTC error: %d\n", result);
-			exit(1);
-		}
+	const size_t bytes_read = reader.mem_pos + reader.file_read;
+
+#if ALIGNCHAR_POSIX
+	if (show_progress) {
+		progress_stop(&progress);
+	}
+#endif
+
+	if (print_counts) {
+		print_rule_counts(stderr, &config, &stats);
 	}
 
 	// Close input and output files.
 
-	const int input_fclose_code = fclose(input);
+	phase_start(&times, PHASE_CLOSE);
+
+	// Args: bytes written (derived as in print_stats).
+	TRACEPOINT1(write_flush,
+		bytes_read + stats.pad_written - stats.pad_removed);
+	const int output_flush_code = fflush(output);
+
+	const int input_fclose_code = (input != NULL) ? fclose(input) : 0;
 	if (input_fclose_code != 0) {
 		fprintf(stderr, "Failed to properly close input file: %s\n",
 			input_path);
 	}
 
 	const int output_fclose_code = fclose(output);
-	if (output_fclose_code != 0) {
+	if (output_flush_code != 0 || output_fclose_code != 0) {
 		fprintf(stderr, "Failed to properly close output file: %s\n",
-			output_path);
+			write_path);
 	}
 
-	// Try to delete the backup file only if it closed properly.
-	if (output_mode == OUTPUT_MODE_IN_PLACE && input_fclose_code == 0) {
-		const int remove_code = remove(INPUT_PATH_RENAMED);
+	// Replace the input file with its aligned form only if that was fully
+	//  written. Otherwise, leave the input file unchanged.
+	int rename_code = 0;
+	if (output_mode == OUTPUT_MODE_IN_PLACE) {
+		if (output_flush_code == 0 && output_fclose_code == 0) {
+			const double rename_start = wall_seconds();
+			rename_code = rename(aligned_path, output_path);
+			trace_span(0, "rename", output_path, rename_start, wall_seconds());
 
-		if (remove_code != 0) {
-			// Something did not go quite right.
-			return 1;
+			if (rename_code != 0) {
+				fprintf(stderr, "Failed to move %s over %s\n", aligned_path,
+					output_path);
+			}
+		}
+
+		if (rename_code != 0 || output_flush_code != 0 ||
+			output_fclose_code != 0)
+		{
+			remove(aligned_path);
 		}
 	}
 
-	if (input_fclose_code != 0 || output_fclose_code != 0) {
+	phase_stop(&times, PHASE_CLOSE);
+
+	// Args: path of the file, bytes read, lines aligned.
+	TRACEPOINT3(file_end, times.path, bytes_read,
+		count_aligned(&config, &stats));
+
+	if (print_run_stats) {
+		print_stats(stderr, stats_json, &config, &stats, &times, bytes_read);
+	}
+
+	if (use_perf_counters) {
+		print_perf_counters(stderr, output_path, &times);
+	}
+
+	if (trace_path != NULL && !write_trace(trace_path)) {
+		return 1;
+	}
+
+	if (rename_code != 0) {
+		// Something did not go quite right.
+		return 1;
+	}
+
+	if (input_fclose_code != 0 || output_flush_code != 0 ||
+		output_fclose_code != 0)
+	{
 		// Something did not go quite right.
 		return 1;
 	}
@@ -0,0 +1,102 @@
+#!/bin/sh
+# File: bench/check.sh
+# License: BSD 2-Clause License (see LICENSE.txt)
+#
+# Rerun the benchmark suite and compare it against a baseline written by
+#  an earlier run with -u.
+# A scenario has regressed when its median throughput is more than threshold
+#  percent below the baseline median and the confidence intervals of the two
+#  medians do not overlap, so run-to-run noise alone does not fail the check.
+# Exits 1 if any scenario regressed or is missing.
+#
+# Usage: bench/check.sh [-u] <alignchar> <corpus dir> <repetitions>
+#                       <baseline file> [threshold percent]
+# With -u, write the baseline file instead of checking against it.
+
+set -e
+
+UPDATE=false
+if [ "$1" = "-u" ]; then
+	UPDATE=true
+	shift
+fi
+
+if [ $# -lt 4 ] || [ $# -gt 5 ]; then
+	echo "Usage: $0 [-u] <alignchar> <corpus dir> <repetitions>" \
+		"<baseline file> [threshold percent]" >&2
+	exit 1
+fi
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BASELINE=$4
+THRESHOLD=${5:-10}
+
+SAMPLES=$(mktemp)
+CURRENT=$(mktemp)
+trap 'rm -f "$SAMPLES" "$CURRENT"' EXIT
+
+"$BENCH_DIR/run.sh" "$1" "$2" "$3" "$SAMPLES" > /dev/null
+sort -k1,1 -k2,2 -k3,3g "$SAMPLES" | awk -f "$BENCH_DIR/median.awk" \
+	-f "$BENCH_DIR/summarize.awk" > "$CURRENT"
+
+if $UPDATE; then
+	{
+		echo "# scenario file runs median_mb_s ci_lo ci_hi"
+		echo "# corpus: $(du -sk "$2" | cut -f 1) KiB, host: $(uname -sm)"
+		cat "$CURRENT"
+	} > "$BASELINE"
+	echo "Wrote $BASELINE"
+	exit 0
+fi
+
+awk -v threshold="$THRESHOLD" '
+	FNR == NR {
+		if ($1 !~ /^#/) {
+			base[$1 " " $2] = $4
+			base_lo[$1 " " $2] = $5
+		}
+		next
+	}
+
+	{
+		key = $1 " " $2
+		seen[key] = 1
+
+		if (!(key in base)) {
+			status = "NEW"
+			change = 0
+		}
+		else {
+			change = 100 * ($4 - base[key]) / base[key]
+			status = (change < -threshold && $6 < base_lo[key]) ? \
+				"REGRESSED" : "ok"
+		}
+
+		if (status == "REGRESSED") {
+			failed = 1
+		}
+
+		printf "%-10s %-14s %10s %10.1f %10.1f %10.1f %+8.1f%% %s\n", $1, $2, \
+			(key in base) ? sprintf("%.1f", base[key]) : "-", \
+			$4, $5, $6, change, status
+	}
+
+	BEGIN {
+		printf "%-10s %-14s %10s %10s %10s %10s %9s %s\n", "scenario", \
+			"file", "base_mb_s", "median", "ci_lo", "ci_hi", "change", "status"
+	}
+
+	END {
+		for (key in base) {
+			if (!(key in seen)) {
+				printf "%-25s missing from this run\n", key
+				failed = 1
+			}
+		}
+
+		if (failed) {
+			printf "Benchmark regression beyond %s%%.\n", threshold
+			exit 1
+		}
+	}
+' "$BASELINE" "$CURRENT"
@@ -0,0 +1,135 @@
+#!/bin/sh
+# File: bench/compare.sh
+# License: BSD 2-Clause License (see LICENSE.txt)
+#
+# Compare alignchar against sed, awk, and perl one-liners applying the same
+#  default rule (pad before a line-ending '\' to column 80, tabs 4 wide).
+# Each tool's output is first checked against alignchar's. Only tools that
+#  produce identical output on a file are timed on it.
+# The sed version cannot count tab widths, so it only matches on files
+#  without tabs.
+# Large files report streaming throughput. The small file reports latency
+#  per invocation, mostly process startup.
+#
+# Usage: bench/compare.sh <alignchar> <corpus dir> [repetitions]
+
+set -e
+
+if [ $# -lt 2 ] || [ $# -gt 3 ]; then
+	echo "Usage: $0 <alignchar> <corpus dir> [repetitions]" >&2
+	exit 1
+fi
+
+ALIGNCHAR=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+CORPUS=$(cd "$2" && pwd)
+REPS=${3:-5}
+# Invocations per timing of the small file.
+SMALL_RUNS=50
+
+. "$(dirname "$0")/lib.sh"
+
+TAB=$(printf '\t')
+SPACES=$(printf '%79s' '')
+
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+cd "$SCRATCH"
+
+# Write the aligned form of file $2 to stdout using tool $1.
+align_with() {
+	case "$1" in
+		alignchar)
+			"$ALIGNCHAR" -i "$2" -o /dev/stdout
+			;;
+		awk)
+			awk '{
+				if (substr($0, length($0)) == "\\") {
+					pre = substr($0, 1, length($0) - 1)
+					w = length(pre) + 3 * gsub(/\t/, "\t", pre) + 1
+					if (w < 80) {
+						pad = sprintf("%" (80 - w) "s", "")
+						$0 = pre pad "\\"
+					}
+				}
+				print
+			}' "$2"
+			;;
+		perl)
+			perl -pe 'if (/^(.*)\\\n\z/) {
+				my $p = $1;
+				my $w = length($p) + 3 * ($p =~ tr/\t//) + 1;
+				$_ = $p . (" " x (80 - $w)) . "\\\n" if $w < 80;
+			}' "$2"
+			;;
+		sed)
+			# Append 79 spaces before the '\', then keep only the first 79 chars.
+			sed -e "/^[^$TAB]\{0,78\}\\\\\$/{" \
+				-e "s/\\\\\$/$SPACES\\\\/" \
+				-e "s/^\(.\{79\}\) *\\\\\$/\1\\\\/" \
+				-e '}' "$2"
+			;;
+	esac
+}
+
+# Print median seconds for $3 runs of tool $1 over file $2.
+time_tool() {
+	: > times
+	i=0
+	while [ "$i" -lt "$REPS" ]; do
+		began=$(now)
+		j=0
+		while [ "$j" -lt "$3" ]; do
+			align_with "$1" "$2" > out
+			j=$((j + 1))
+		done
+		ended=$(now)
+		echo "$began $ended $3" | awk '{ printf "%.9f\n", ($2 - $1) / $3 }' \
+			>> times
+		i=$((i + 1))
+	done
+	median times
+}
+
+TOOLS=alignchar
+for tool in awk perl sed; do
+	if command -v "$tool" > /dev/null 2>&1; then
+		TOOLS="$TOOLS $tool"
+	fi
+done
+
+# A 1 KiB file of whole lines for startup cost.
+head -c 1024 "$CORPUS/allbs.txt" | sed '$d' > small.txt
+
+printf "%-14s %-10s %10s %12s %12s\n" \
+	file tool mb_s latency_ms vs_alignchar
+
+for file in small.txt "$CORPUS"/*; do
+	if [ "$file" = small.txt ]; then
+		runs=$SMALL_RUNS
+	else
+		runs=1
+	fi
+
+	bytes=$(wc -c < "$file")
+	align_with alignchar "$file" > expected
+	base_s=
+
+	for tool in $TOOLS; do
+		align_with "$tool" "$file" > actual
+		if ! cmp -s expected actual; then
+			printf "%-14s %-10s %10s %12s %12s\n" \
+				"$(basename "$file")" "$tool" - - "output differs"
+			continue
+		fi
+
+		s=$(time_tool "$tool" "$file" "$runs")
+		if [ -z "$base_s" ]; then
+			base_s=$s
+		fi
+
+		echo "$(basename "$file") $tool $bytes $s $base_s" | awk '{
+			printf "%-14s %-10s %10.1f %12.3f %11.2fx\n", $1, $2,
+				$3 / 1e6 / $4, $4 * 1e3, $4 / $5
+		}'
+	done
+done
@@ -0,0 +1,208 @@
+/*
+File: bench/gencorpus.c
+License: BSD 2-Clause License
+
+Copyright 2021 Costava
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Write the benchmark corpus used by `make bench`.
+// The same size and seed always produce the same files.
+//
+// Usage: gencorpus <directory> [kib per file] [seed]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Must match BUF_CAP in alignchar.c.
+#define BUF_CAP 2048
+
+#define DEFAULT_KIB 4096
+#define DEFAULT_SEED 1
+
+#define PATH_CAP 4096
+
+////////////////////////////////////////////////////////////////////////////////
+
+// State of the xorshift64 generator. Never 0.
+static uint64_t rng_state = DEFAULT_SEED;
+
+// Return the next pseudorandom number.
+uint64_t rng_next(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+
+	return rng_state;
+}
+
+// Return a pseudorandom number in [lo, hi].
+size_t rng_range(const size_t lo, const size_t hi) {
+	return lo + (size_t)(rng_next() % (uint64_t)(hi - lo + 1));
+}
+
+// Write ch to fp count times.
+void write_repeated(FILE *const fp, const char ch, const size_t count) {
+	for (size_t i = 0; i < count; i += 1) {
+		fputc(ch, fp);
+	}
+}
+
+// Write count pseudorandom identifier chars to fp.
+void write_word(FILE *const fp, const size_t count) {
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz_0123456789";
+
+	for (size_t i = 0; i < count; i += 1) {
+		fputc(chars[rng_next() % (sizeof(chars) - 1)], fp);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Multi-line macros, each line but the last continued with a backslash.
+void gen_macros(FILE *const fp, const long target) {
+	while (ftell(fp) < target) {
+		fprintf(fp, "#define ");
+		write_word(fp, rng_range(4, 20));
+		fprintf(fp, "(x, y) \\\n");
+
+		const size_t num_lines = rng_range(2, 30);
+		for (size_t i = 0; i < num_lines; i += 1) {
+			fputc('\t', fp);
+			write_word(fp, rng_range(1, 60));
+			fprintf(fp, "(x); \\\n");
+		}
+
+		fprintf(fp, "\tdone(y)\n\n");
+	}
+}
+
+// Minified lines with lengths around and above BUF_CAP.
+void gen_minified(FILE *const fp, const long target) {
+	while (ftell(fp) < target) {
+		write_word(fp, rng_range(BUF_CAP - 64, BUF_CAP * 3));
+
+		if (rng_next() % 2 == 0) {
+			fprintf(fp, " \\");
+		}
+
+		fputc('\n', fp);
+	}
+}
+
+// Tab-indented code, some lines continued with a backslash.
+void gen_tabs(FILE *const fp, const long target) {
+	while (ftell(fp) < target) {
+		write_repeated(fp, '\t', rng_range(0, 6));
+		write_word(fp, rng_range(0, 40));
+
+		if (rng_next() % 3 == 0) {
+			fputc('\t', fp);
+			write_word(fp, rng_range(1, 10));
+		}
+
+		if (rng_next() % 2 == 0) {
+			fprintf(fp, " \\");
+		}
+
+		fputc('\n', fp);
+	}
+}
+
+// Only newlines.
+void gen_blank(FILE *const fp, const long target) {
+	write_repeated(fp, '\n', (size_t)target);
+}
+
+// Every line ends in a backslash.
+void gen_allbs(FILE *const fp, const long target) {
+	while (ftell(fp) < target) {
+		write_word(fp, rng_range(0, 78));
+		fprintf(fp, " \\\n");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct corpus_file {
+	const char *name;
+	void (*gen)(FILE *fp, long target);
+};
+
+static const struct corpus_file corpus_files[] = {
+	{"macros.h",     gen_macros},
+	{"minified.txt", gen_minified},
+	{"tabs.c",       gen_tabs},
+	{"blank.txt",    gen_blank},
+	{"allbs.txt",    gen_allbs},
+};
+
+int main(int argc, char *argv[]) {
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Usage: %s <directory> [kib per file] [seed]\n",
+			argv[0]);
+		exit(1);
+	}
+
+	const long kib = (argc > 2) ? strtol(argv[2], NULL, 10) : DEFAULT_KIB;
+	const long long seed = (argc > 3) ?
+		strtoll(argv[3], NULL, 10) : DEFAULT_SEED;
+
+	if (kib <= 0) {
+		fprintf(stderr, "Expected positive kib per file. Got: %s\n", argv[2]);
+		exit(1);
+	}
+
+	if (seed == 0) {
+		fprintf(stderr, "Seed must not be 0.\n");
+		exit(1);
+	}
+
+	const size_t num_files = sizeof(corpus_files) / sizeof(corpus_files[0]);
+
+	for (size_t i = 0; i < num_files; i += 1) {
+		// Each file gets its own stream so adding a file keeps the others.
+		rng_state = (uint64_t)seed * 0x9E3779B97F4A7C15u + (uint64_t)i + 1;
+
+		char path[PATH_CAP];
+		snprintf(path, sizeof(path), "%s/%s", argv[1], corpus_files[i].name);
+
+		FILE *const fp = fopen(path, "wb");
+		if (fp == NULL) {
+			fprintf(stderr, "Failed to open %s for writing.\n", path);
+			exit(1);
+		}
+
+		corpus_files[i].gen(fp, kib * 1024);
+
+		if (fclose(fp) != 0) {
+			fprintf(stderr, "Failed to write %s.\n", path);
+			exit(1);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*
+File: bench/kernels.c
+License: BSD 2-Clause License
+
+Copyright 2021 Costava
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Microbenchmarks of the line engine's inner routines on in-memory buffers.
+// Sweeps line length, tab density, and the fraction of lines that are
+//  candidates (end in '\'), printing one row per kernel and sweep point.
+// Cycles are timestamp counter ticks, so only available on x86.
+//
+// Usage: kernels [repetitions]
+
+// The kernels are called directly, so alignchar is compiled in with its
+//  main renamed.
+#define main alignchar_main
+#include "../alignchar.c"
+#undef main
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#else
+#define HAVE_CYCLES 0
+#endif
+
+// Size of the buffer each kernel is run over.
+#define TEXT_CAP (1024 * 1024)
+
+#define DEFAULT_REPS 5
+
+static char text[TEXT_CAP];
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Timestamp counter ticks, or 0 where not available.
+uint64_t cycles_now(void) {
+#if HAVE_CYCLES
+	return (uint64_t)__rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Fill text with lines of line_len chars before the '\n'.
+// tab_pct percent of chars are tabs. cand_pct percent of lines end in '\'.
+// Return the number of chars written, a whole number of lines.
+size_t fill_text(const size_t line_len, const unsigned tab_pct,
+	const unsigned cand_pct)
+{
+	// Fixed seed, so every run measures the same text.
+	unsigned long long state = 88172645463325252ull;
+	size_t len = 0;
+
+	while (len + line_len + 1 <= TEXT_CAP) {
+		for (size_t i = 0; i < line_len; i += 1) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+
+			text[len + i] = (state % 100 < tab_pct) ? '\t' : 'x';
+		}
+
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+
+		if (state % 100 < cand_pct) {
+			text[len + line_len - 1] = '\\';
+		}
+
+		text[len + line_len] = '\n';
+		len += line_len + 1;
+	}
+
+	return len;
+}
+
+// Read all of text[0..len) a line at a time. Return a checksum.
+size_t kernel_read_through_char(const size_t len, const size_t line_len,
+	const struct align_config *const config)
+{
+	(void)line_len;
+	(void)config;
+
+	// Designated, so fields added to struct reader start zeroed.
+	struct reader reader = {.mem = text, .mem_len = len};
+	char buf[BUF_CAP];
+	size_t sum = 0;
+
+	while (true) {
+		size_t buf_len;
+		const uint8_t result = read_through_char(&reader, buf, BUF_CAP, '\n',
+			&buf_len);
+		sum += buf_len;
+
+		if (result == RTC_EOF_REACHED) {
+			return sum;
+		}
+	}
+}
+
+// Measure the width of each line of text[0..len). Return a checksum.
+size_t kernel_get_span_width(const size_t len, const size_t line_len,
+	const struct align_config *const config)
+{
+	size_t sum = 0;
+
+	for (size_t at = 0; at < len; at += line_len + 1) {
+		sum += get_span_width(text + at, line_len, config->tab_width);
+	}
+
+	return sum;
+}
+
+// Match each line of text[0..len) against the rules. Return a checksum.
+size_t kernel_match_line(const size_t len, const size_t line_len,
+	const struct align_config *const config)
+{
+	size_t sum = 0;
+
+	for (size_t at = 0; at < len; at += line_len + 1) {
+		sum += match_line(config, text + at, line_len + 1).rule_i;
+	}
+
+	return sum;
+}
+
+struct kernel {
+	const char *name;
+	size_t (*run)(size_t len, size_t line_len,
+		const struct align_config *config);
+};
+
+static const struct kernel kernels[] = {
+	{"read_through_char", kernel_read_through_char},
+	{"get_span_width",    kernel_get_span_width},
+	{"match_line",        kernel_match_line},
+};
+
+static const size_t line_lens[] = {
+	1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096
+};
+static const unsigned tab_pcts[] = {0, 10, 50};
+static const unsigned cand_pcts[] = {0, 50, 100};
+
+#define LENGTH_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+int main(int argc, char *argv[]) {
+	const long reps = (argc > 1) ? strtol(argv[1], NULL, 10) : DEFAULT_REPS;
+
+	if (reps <= 0) {
+		fprintf(stderr, "Usage: %s [repetitions]\n", argv[0]);
+		exit(1);
+	}
+
+	// One end-of-line rule with the defaults.
+	static struct align_config config;
+	config.tab_width = 4;
+	start_rule(&config);
+	memset(config.rule_index, NO_RULE, sizeof(config.rule_index));
+	config.rule_index[(unsigned char)DEFAULT_TARGET_CHAR] = 0;
+
+	printf("%-18s %8s %6s %6s %12s %15s\n",
+		"kernel", "line_len", "tab_%", "cand_%", "ns_per_byte", "cycles_per_byte");
+
+	// Keeps the checksums, and so the kernels, from being optimized away.
+	volatile size_t sink = 0;
+
+	for (size_t k = 0; k < LENGTH_OF(kernels); k += 1) {
+	for (size_t l = 0; l < LENGTH_OF(line_lens); l += 1) {
+	for (size_t t = 0; t < LENGTH_OF(tab_pcts); t += 1) {
+	for (size_t c = 0; c < LENGTH_OF(cand_pcts); c += 1) {
+		const size_t len = fill_text(line_lens[l], tab_pcts[t], cand_pcts[c]);
+
+		// Best of reps, the run least disturbed by the rest of the system.
+		double best_s = 0;
+		uint64_t best_cycles = 0;
+
+		for (long r = 0; r < reps; r += 1) {
+			const double began = wall_seconds();
+			const uint64_t began_cycles = cycles_now();
+
+			sink += kernels[k].run(len, line_lens[l], &config);
+
+			const uint64_t cycles = cycles_now() - began_cycles;
+			const double s = wall_seconds() - began;
+
+			if (r == 0 || s < best_s) {
+				best_s = s;
+				best_cycles = cycles;
+			}
+		}
+
+		printf("%-18s %8zu %6u %6u %12.3f", kernels[k].name, line_lens[l],
+			tab_pcts[t], cand_pcts[c], best_s * 1e9 / (double)len);
+
+		if (HAVE_CYCLES) {
+			printf(" %15.3f\n", (double)best_cycles / (double)len);
+		}
+		else {
+			printf(" %15s\n", "-");
+		}
+	}
+	}
+	}
+	}
+
+	(void)sink;
+	return 0;
+}
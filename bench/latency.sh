@@ -0,0 +1,69 @@
+#!/bin/sh
+# File: bench/latency.sh
+# License: BSD 2-Clause License (see LICENSE.txt)
+#
+# Measure exec-to-exit latency of aligning a 1 KiB file, to a new file and
+#  --in-place, for each alignchar binary given. Pass an older build as well
+#  to compare before and after a change.
+# Each timing covers a batch of invocations run back to back from the
+#  shell, and the median over repetitions batches is reported.
+#
+# Usage: bench/latency.sh <corpus dir> <repetitions> <alignchar>...
+
+set -e
+
+if [ $# -lt 3 ]; then
+	echo "Usage: $0 <corpus dir> <repetitions> <alignchar>..." >&2
+	exit 1
+fi
+
+CORPUS=$(cd "$1" && pwd)
+REPS=$2
+shift 2
+# Invocations per timing.
+RUNS=200
+
+. "$(dirname "$0")/lib.sh"
+
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+
+# Binaries are resolved before leaving the caller's directory.
+BINS=
+for bin in "$@"; do
+	BINS="$BINS $(cd "$(dirname "$bin")" && pwd)/$(basename "$bin")"
+done
+cd "$SCRATCH"
+
+# A 1 KiB file of whole lines.
+head -c 1024 "$CORPUS/allbs.txt" | sed '$d' > small.txt
+
+printf "%-40s %-10s %12s\n" alignchar mode latency_us
+
+for bin in $BINS; do
+	for mode in output inplace; do
+		: > times
+		i=0
+		while [ "$i" -lt "$REPS" ]; do
+			cp small.txt in.txt
+			began=$(now)
+			j=0
+			while [ "$j" -lt "$RUNS" ]; do
+				if [ "$mode" = output ]; then
+					"$bin" -i small.txt -o out.txt
+				else
+					"$bin" -i in.txt --in-place
+				fi
+				j=$((j + 1))
+			done
+			ended=$(now)
+			echo "$began $ended $RUNS" | awk '{ printf "%.9f\n", ($2 - $1) / $3 }' \
+				>> times
+			i=$((i + 1))
+		done
+
+		echo "$bin $mode $(median times)" | awk '{
+			printf "%-40s %-10s %12.1f\n", $1, $2, $3 * 1e6
+		}'
+	done
+done
@@ -0,0 +1,22 @@
+# File: bench/lib.sh
+# License: BSD 2-Clause License (see LICENSE.txt)
+#
+# Helpers shared by the bench scripts. Source it before changing directory:
+#  . "$(dirname "$0")/lib.sh"
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+
+# awk function median(v, n), to prepend to awk programs.
+MEDIAN_AWK=$(cat "$BENCH_DIR/median.awk")
+
+# Print wall seconds since the epoch with nanoseconds.
+now() {
+	date +%s.%N
+}
+
+# Print the median of the numbers in file $1.
+median() {
+	sort -g "$1" | awk "$MEDIAN_AWK"'
+		{ v[NR] = $1 }
+		END { printf "%.6f", median(v, NR) }'
+}
@@ -0,0 +1,9 @@
+# File: bench/median.awk
+# License: BSD 2-Clause License (see LICENSE.txt)
+#
+# Median of v[1..n], which must be sorted. Shared by the bench scripts
+#  (through bench/lib.sh) and bench/summarize.awk.
+
+function median(v, n) {
+	return (n % 2) ? v[(n + 1) / 2] : (v[n / 2] + v[n / 2 + 1]) / 2
+}
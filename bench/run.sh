@@ -0,0 +1,126 @@
+#!/bin/sh
+# File: bench/run.sh
+# License: BSD 2-Clause License (see LICENSE.txt)
+#
+# Run alignchar over each file of the benchmark corpus with each option set
+#  and print a results table to stdout.
+# Throughput and peak RSS come from alignchar's own --stats=json.
+# Syscalls are counted with strace when it is installed, else shown as -.
+#
+# If a samples file is given, each run's throughput is appended to it as
+#  "scenario file mb_s" for bench/check.sh.
+#
+# Usage: bench/run.sh <alignchar> <corpus dir> [repetitions] [samples file]
+
+set -e
+
+if [ $# -lt 2 ] || [ $# -gt 4 ]; then
+	echo "Usage: $0 <alignchar> <corpus dir> [repetitions] [samples file]" >&2
+	exit 1
+fi
+
+ALIGNCHAR=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+CORPUS=$(cd "$2" && pwd)
+REPS=${3:-10}
+SAMPLES=
+if [ -n "$4" ]; then
+	: > "$4"
+	SAMPLES=$(cd "$(dirname "$4")" && pwd)/$(basename "$4")
+fi
+
+# Name and arguments of each scenario, one per line.
+SCENARIOS='default|
+char|-c ;
+auto|-p auto
+tabs|-t 8
+inplace|--in-place'
+
+. "$(dirname "$0")/lib.sh"
+
+# --in-place renames its input in the working directory, so run from scratch.
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+cd "$SCRATCH"
+
+# Print the number value of JSON field $1 in file $2.
+json_field() {
+	sed -n "s/.*\"$1\":\([0-9.]*\).*/\1/p" "$2"
+}
+
+# Print the median, min, and max of the numbers in file $1.
+summarize() {
+	sort -g "$1" | awk "$MEDIAN_AWK"'
+		{ v[NR] = $1 }
+		END { printf "%.1f %.1f %.1f", median(v, NR), v[1], v[NR] }'
+}
+
+# Succeed if arguments $1 include --in-place.
+is_in_place() {
+	case "$1" in
+		*--in-place*) return 0 ;;
+		*) return 1 ;;
+	esac
+}
+
+# Run one scenario on file $1 with arguments $2, writing --stats to $3.
+run_once() {
+	if is_in_place "$2"; then
+		cp "$1" input
+		# shellcheck disable=SC2086
+		"$ALIGNCHAR" -i input $2 --stats=json 2> "$3"
+	else
+		# shellcheck disable=SC2086
+		"$ALIGNCHAR" -i "$1" -o output $2 --stats=json 2> "$3"
+	fi
+}
+
+# Print the syscalls made running file $1 with arguments $2, or -.
+count_syscalls() {
+	if ! command -v strace > /dev/null 2>&1; then
+		echo -
+		return
+	fi
+
+	if is_in_place "$2"; then
+		cp "$1" input
+		# shellcheck disable=SC2086
+		strace -f -c -o syscalls "$ALIGNCHAR" -i input $2 > /dev/null
+	else
+		# shellcheck disable=SC2086
+		strace -f -c -o syscalls "$ALIGNCHAR" -i "$1" -o output $2 > /dev/null
+	fi
+
+	awk '$NF == "total" { print $(NF - 2) }' syscalls
+}
+
+printf "%-10s %-14s %6s %10s %10s %10s %12s %10s\n" \
+	scenario file runs median_mb_s min_mb_s max_mb_s peak_rss_kib syscalls
+
+echo "$SCENARIOS" | while IFS='|' read -r name args; do
+	for file in "$CORPUS"/*; do
+		: > samples
+		rss=0
+
+		i=0
+		while [ "$i" -lt "$REPS" ]; do
+			run_once "$file" "$args" stats
+			json_field throughput_mb_s stats >> samples
+
+			if [ -n "$SAMPLES" ]; then
+				echo "$name $(basename "$file") $(tail -n 1 samples)" >> "$SAMPLES"
+			fi
+
+			run_rss=$(json_field peak_rss_kib stats)
+			if [ "$run_rss" -gt "$rss" ]; then
+				rss=$run_rss
+			fi
+
+			i=$((i + 1))
+		done
+
+		set -- $(summarize samples)
+		printf "%-10s %-14s %6d %10s %10s %10s %12s %10s\n" \
+			"$name" "$(basename "$file")" "$REPS" "$1" "$2" "$3" "$rss" \
+			"$(count_syscalls "$file" "$args")"
+	done
+done
@@ -0,0 +1,139 @@
+#!/bin/sh
+# File: bench/scaling.sh
+# License: BSD 2-Clause License (see LICENSE.txt)
+#
+# Run 1 to N copies of a workload at once and print, as CSV, how the wall
+#  time scales:
+#   large    Each copy aligns one large corpus file to a new file.
+#   inplace  Each copy aligns its own large file --in-place, all in one
+#            working directory.
+#   small    Each copy runs alignchar once per file over a tree of small
+#            files, as xargs -n1 would.
+# speedup is how many times more work per second N copies do than one.
+# efficiency is speedup / N. mismatches counts copies whose output was not
+#  the expected alignment.
+# The plateau, the fewest copies within 10% of the best speedup, is printed
+#  to stderr per workload.
+#
+# Usage: bench/scaling.sh <alignchar> <corpus dir> [max copies] [small files]
+
+set -e
+
+if [ $# -lt 2 ] || [ $# -gt 4 ]; then
+	echo "Usage: $0 <alignchar> <corpus dir> [max copies] [small files]" >&2
+	exit 1
+fi
+
+ALIGNCHAR=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+CORPUS=$(cd "$2" && pwd)
+MAX_COPIES=${3:-$(getconf _NPROCESSORS_ONLN 2> /dev/null || echo 4)}
+NUM_SMALL=${4:-200}
+
+LARGE=$CORPUS/macros.h
+
+. "$(dirname "$0")/lib.sh"
+
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+cd "$SCRATCH"
+
+"$ALIGNCHAR" -i "$LARGE" -o large_expected
+
+# Cut the tree of small files out of the corpus at line boundaries.
+mkdir small_src
+head -n $((NUM_SMALL * 20)) "$LARGE" | split -l 20 -a 4 - small_src/f.
+for f in small_src/*; do
+	"$ALIGNCHAR" -i "$f" -o "$f.expected"
+done
+
+# Get copy $2 of workload $1 ready to run.
+prepare() {
+	case "$1" in
+		large) ;;
+		inplace) cp "$LARGE" "in.$2" ;;
+		small)
+			rm -rf "tree.$2"
+			mkdir "tree.$2"
+			cp small_src/f.???? "tree.$2/"
+			;;
+	esac
+}
+
+# Run copy $2 of workload $1.
+run_copy() {
+	case "$1" in
+		large) "$ALIGNCHAR" -i "$LARGE" -o "out.$2" ;;
+		inplace) "$ALIGNCHAR" -i "in.$2" --in-place ;;
+		small)
+			for f in "tree.$2"/*; do
+				"$ALIGNCHAR" -i "$f" -o "$f.out"
+			done
+			;;
+	esac
+}
+
+# Succeed if copy $2 of workload $1 produced the expected output.
+verify() {
+	case "$1" in
+		large) cmp -s "out.$2" large_expected ;;
+		inplace) cmp -s "in.$2" large_expected ;;
+		small)
+			for f in "tree.$2"/f.????; do
+				cmp -s "$f.out" "small_src/$(basename "$f").expected" || return 1
+			done
+			;;
+	esac
+}
+
+echo "workload,copies,wall_s,speedup,efficiency,mismatches"
+
+for workload in large inplace small; do
+	: > results
+	copies=1
+	while [ "$copies" -le "$MAX_COPIES" ]; do
+		i=1
+		while [ "$i" -le "$copies" ]; do
+			prepare "$workload" "$i"
+			i=$((i + 1))
+		done
+
+		began=$(now)
+		i=1
+		while [ "$i" -le "$copies" ]; do
+			run_copy "$workload" "$i" 2> /dev/null &
+			i=$((i + 1))
+		done
+		wait
+		ended=$(now)
+
+		mismatches=0
+		i=1
+		while [ "$i" -le "$copies" ]; do
+			verify "$workload" "$i" || mismatches=$((mismatches + 1))
+			i=$((i + 1))
+		done
+
+		echo "$workload $copies $began $ended $mismatches" >> results
+		copies=$((copies + 1))
+	done
+
+	awk '{
+		n[NR] = $2; wall[NR] = $4 - $3; bad[NR] = $5
+	}
+	END {
+		best = 0
+		for (i = 1; i <= NR; i += 1) {
+			speedup[i] = n[i] * wall[1] / wall[i]
+			if (speedup[i] > best) best = speedup[i]
+			printf "%s,%d,%.4f,%.3f,%.3f,%d\n", $1, n[i], wall[i],
+				speedup[i], speedup[i] / n[i], bad[i]
+		}
+		for (i = 1; i <= NR; i += 1) {
+			if (speedup[i] >= 0.9 * best) {
+				printf "%s: plateau at %d copies (speedup %.2f)\n", $1, n[i],
+					speedup[i] > "/dev/stderr"
+				break
+			}
+		}
+	}' results
+done
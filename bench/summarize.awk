@@ -0,0 +1,42 @@
+# File: bench/summarize.awk
+# License: BSD 2-Clause License (see LICENSE.txt)
+#
+# Summarize bench/run.sh samples ("scenario file mb_s" lines, sorted by
+#  scenario, file, then mb_s) as "scenario file runs median ci_lo ci_hi".
+# ci_lo and ci_hi bound the median with about 95% confidence. They are the
+#  order statistics a binomial(n, 1/2) distribution puts 1.96 standard
+#  deviations either side of the middle, so no distribution is assumed
+#  for the samples themselves.
+
+# Needs bench/median.awk loaded first (awk -f median.awk -f summarize.awk).
+
+function flush_key(    lo, hi, half) {
+	if (n == 0) {
+		return
+	}
+
+	half = 1.96 * sqrt(n) / 2
+	lo = int(n / 2 - half)
+	hi = int(n / 2 + 1 + half + 0.999999)
+	if (lo < 1) lo = 1
+	if (hi > n) hi = n
+
+	printf "%s %s %d %.1f %.1f %.1f\n", key_scenario, key_file, n, \
+		median(v, n), v[lo], v[hi]
+	n = 0
+}
+
+{
+	if ($1 != key_scenario || $2 != key_file) {
+		flush_key()
+		key_scenario = $1
+		key_file = $2
+	}
+
+	n += 1
+	v[n] = $3
+}
+
+END {
+	flush_key()
+}